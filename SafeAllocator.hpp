@@ -0,0 +1,299 @@
+#ifndef SAFE_ALLOCATOR_HPP_
+#define SAFE_ALLOCATOR_HPP_
+
+// Header-only C++ front end for Safemalloc: an STL allocator, a pmr memory_resource and a checked span.
+// The Policy parameter picks at compile time how much checking a build pays for:
+//     safe::Tracking       every block goes through mallocSafe/freeSafe/reallocSafe and span accesses are checked
+//     safe::Sampling<N>    every Nth block is tracked, the rest use plain malloc (freeing asks the tree which is which)
+//     safe::NoTracking     plain malloc/free/realloc and unchecked spans - compiles down to the raw calls
+// A checked span always bounds-checks against its own length; it is also checked against its block when the range it
+// views lies inside a live tracked block, under either checking policy. Anything else (stack arrays, memory from another
+// allocator, blocks Sampling left untracked) only gets the length check.
+// safe::DefaultPolicy is NoTracking when NDEBUG is defined and Tracking otherwise. Requires C++17.
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include "Safemalloc.h"
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define SAFE_ALLOCATOR_HAS_PMR 1
+#endif
+
+namespace safe
+{
+
+//every block goes through the range tree
+struct Tracking
+{
+    static constexpr bool checks = true;
+
+    static void * allocate(std::size_t bytes) { return mallocSafe(bytes); }
+    static void deallocate(void * ptr) { freeSafe(ptr); }
+    static void * reallocate(void * ptr, std::size_t bytes) { return reallocSafe(ptr, bytes); }
+    static bool tracks(void * ptr, std::size_t bytes) { return isTrackedSafe(ptr, bytes) != 0; }
+};
+
+//every Rate-th block goes through the range tree, so checking costs a fraction of Tracking
+template <unsigned int Rate>
+struct Sampling
+{
+    static_assert(Rate > 0, "sampling rate must be at least 1");
+    static constexpr bool checks = true;
+
+    static void * allocate(std::size_t bytes)
+    {
+        if(++count % Rate == 0)
+        {
+            return mallocSafe(bytes);
+        }
+
+        void * ptr = std::malloc(bytes);
+        if(!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void deallocate(void * ptr)
+    {
+        if(isAllocatedSafe(ptr))
+        {
+            freeSafe(ptr);
+        }
+        else
+        {
+            std::free(ptr);
+        }
+    }
+
+    static void * reallocate(void * ptr, std::size_t bytes)
+    {
+        if(isAllocatedSafe(ptr))
+        {
+            return reallocSafe(ptr, bytes);
+        }
+
+        void * pointer = std::realloc(ptr, bytes);
+        if(!pointer && bytes != 0)
+        {
+            throw std::bad_alloc();
+        }
+        return pointer;
+    }
+
+    static bool tracks(void * ptr, std::size_t bytes) { return isTrackedSafe(ptr, bytes) != 0; }
+
+    inline static unsigned long count = 0;
+};
+
+//raw allocation, no tree and no checks
+struct NoTracking
+{
+    static constexpr bool checks = false;
+
+    static void * allocate(std::size_t bytes)
+    {
+        void * ptr = std::malloc(bytes);
+        if(!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void deallocate(void * ptr) { std::free(ptr); }
+
+    static void * reallocate(void * ptr, std::size_t bytes)
+    {
+        void * pointer = std::realloc(ptr, bytes);
+        if(!pointer && bytes != 0)
+        {
+            throw std::bad_alloc();
+        }
+        return pointer;
+    }
+
+    static bool tracks(void *, std::size_t) { return false; }
+};
+
+#ifdef NDEBUG
+using DefaultPolicy = NoTracking;
+#else
+using DefaultPolicy = Tracking;
+#endif
+
+
+//standard Allocator for std::vector and friends
+template <class T, class Policy = DefaultPolicy>
+class Allocator
+{
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    template <class U>
+    struct rebind
+    {
+        using other = Allocator<U, Policy>;
+    };
+
+    static_assert(alignof(T) <= alignof(std::max_align_t), "safe::Allocator only hands out malloc-aligned memory");
+
+    Allocator() noexcept = default;
+
+    template <class U>
+    Allocator(const Allocator<U, Policy> &) noexcept {}
+
+    T * allocate(std::size_t n)
+    {
+        if(n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(Policy::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T * ptr, std::size_t) noexcept
+    {
+        Policy::deallocate(ptr);
+    }
+
+    //not part of the Allocator requirements - grows or shrinks a block in place where reallocSafe can,
+    //so only for types that may be moved with a plain byte copy
+    T * reallocate(T * ptr, std::size_t n)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "reallocate moves elements with a byte copy");
+        if(n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(Policy::reallocate(ptr, n * sizeof(T)));
+    }
+};
+
+template <class T, class U, class Policy>
+bool operator==(const Allocator<T, Policy> &, const Allocator<U, Policy> &) noexcept
+{
+    return true;
+}
+
+template <class T, class U, class Policy>
+bool operator!=(const Allocator<T, Policy> &, const Allocator<U, Policy> &) noexcept
+{
+    return false;
+}
+
+
+//checked view of n elements at data - every element access is checked against n, and if the view lies in a tracked block
+//it is validated once with safeSpanAcquire and accesses are also checked against the cached block bounds (falling back
+//to a full memcheckSafe-style check if the block changed)
+template <class T, class Policy = DefaultPolicy>
+class Span
+{
+public:
+    Span(T * data, std::size_t n) : data_(data), size_(n), checked_(false)
+    {
+        if constexpr(Policy::checks)
+        {
+            if(n != 0 && Policy::tracks(data, n * sizeof(T)))
+            {
+                span_ = safeSpanAcquire(data, n * sizeof(T));
+                checked_ = true;
+            }
+        }
+    }
+
+    template <class Container>
+    explicit Span(Container & container) : Span(container.data(), container.size()) {}
+
+    T & operator[](std::size_t i)
+    {
+        if constexpr(Policy::checks)
+        {
+            if(i >= size_)
+            {
+                outOfSpan(i);
+            }
+            if(checked_)
+            {
+                return *static_cast<T *>(safeSpanAt(&span_, data_ + i, sizeof(T)));
+            }
+        }
+        return data_[i];
+    }
+
+    //element i of a stride-spaced view, e.g. one field out of an array of records
+    T & strided(std::size_t i, std::size_t stride)
+    {
+        if constexpr(Policy::checks)
+        {
+            if(size_ == 0 || (stride != 0 && i > (size_ - 1) / stride))
+            {
+                outOfSpan(i * stride);
+            }
+            if(checked_)
+            {
+                return *static_cast<T *>(safeSpanStrided(&span_, data_, i, stride * sizeof(T), sizeof(T)));
+            }
+        }
+        return data_[i * stride];
+    }
+
+    T * data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+
+private:
+    [[noreturn]] void outOfSpan(std::size_t i) const
+    {
+        std::fprintf(stderr, "Error: safe::Span identified a faulty memory access.\n");
+        std::fprintf(stderr, "       Attempted to access element %zu of a span of %zu elements.\n", i, size_);
+        std::fprintf(stderr, "       Exiting.\n");
+        std::exit(-1);
+    }
+
+    T * data_;
+    std::size_t size_;
+    bool checked_;
+    safeSpan span_{};
+};
+
+
+#ifdef SAFE_ALLOCATOR_HAS_PMR
+//std::pmr::memory_resource over the same policies, for pmr containers
+template <class Policy = DefaultPolicy>
+class MemoryResource : public std::pmr::memory_resource
+{
+protected:
+    void * do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if(alignment > alignof(std::max_align_t))
+        {
+            throw std::bad_alloc();
+        }
+        return Policy::allocate(bytes);
+    }
+
+    void do_deallocate(void * ptr, std::size_t, std::size_t) override
+    {
+        Policy::deallocate(ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override
+    {
+        return dynamic_cast<const MemoryResource *>(&other) != nullptr;
+    }
+};
+#endif
+
+} // namespace safe
+
+#endif // SAFE_ALLOCATOR_HPP_
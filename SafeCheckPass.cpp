@@ -0,0 +1,459 @@
+// SafeCheckPass : LLVM pass plugin that puts a memcheckSafe-style check in front of every load and store through a pointer,
+//                 so coverage doesn't depend on where memcheckSafe calls were placed by hand.
+//
+// Build with "make plugin", then compile the program with
+//     clang -O1 -fpass-plugin=./SafeCheckPass.so -c file.c
+// (or run it on IR with "opt -load-pass-plugin=./SafeCheckPass.so -passes=safecheck") and link against Safemalloc.o.
+//
+// Each check is the memcheckSafeFast fast path from Safemalloc.h emitted inline: a few compares against the last block
+// found, with a call to memcheckSafeRefill only on a miss. To keep the number of checks down:
+//     - accesses to stack and global objects are skipped, they can never be mallocSafe blocks
+//     - a contiguous walk through memory in a loop (pointer stepping by exactly the access size, trip count known, access
+//       made on every iteration, no calls that could free) is checked once in the loop preheader for the whole range
+//     - accesses at constant offsets from the same pointer within a block, with no call between them, share one check
+//       covering all of them, placed before the first one
+//
+// Written against LLVM 14, which is what "make plugin" is built and tested with (make test-plugin). The handful of APIs
+// that changed in later releases are picked by LLVM_VERSION_MAJOR below.
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+
+#include <cstddef>
+#include <set>
+#include <tuple>
+
+#include "Safemalloc.h"
+
+#if LLVM_VERSION_MAJOR < 14
+#error "SafeCheckPass needs LLVM 14 or later"
+#endif
+
+//the IR emitted below mirrors safeSpan field by field, with unsigned long as the target's intptr type
+static_assert(offsetof(safeSpan, end) == sizeof(char *) && offsetof(safeSpan, generation) == 2 * sizeof(char *)
+              && offsetof(safeSpan, slot) == 2 * sizeof(char *) + sizeof(unsigned long)
+              && sizeof(unsigned long) == sizeof(void *), "safeSpan layout no longer matches the IR the pass emits");
+
+using namespace llvm;
+
+namespace
+{
+
+//one load or store that needs a check
+struct access
+{
+    Instruction * inst;
+    Value * ptr;
+    uint64_t size;
+};
+
+//one check to emit: size bytes at ptr, checked right before inst
+struct check
+{
+    Instruction * inst;
+    Value * ptr;
+    Value * size;
+};
+
+//accesses at constant offsets [low, high) from base, checked together before first
+struct accessGroup
+{
+    Value * base;
+    int64_t low;
+    int64_t high;
+    Instruction * first;
+};
+
+
+class SafeCheckPass : public PassInfoMixin<SafeCheckPass>
+{
+public:
+    PreservedAnalyses run(Function & function, FunctionAnalysisManager & analyses);
+
+    //the checks are the point of the pass, so it has to run on optnone (-O0) functions too
+    static bool isRequired() { return true; }
+};
+
+
+//the runtime's own inline helpers end up in every file that includes Safemalloc.h - checking them would only recurse
+bool isRuntimeFunction(const Function & function)
+{
+    StringRef name = function.getName();
+    return name.take_front(12) == "memcheckSafe" || name.take_front(8) == "safeSpan";
+}
+
+//i8* with typed pointers, ptr once pointers are opaque
+Type * bytePointerType(LLVMContext & context)
+{
+#if LLVM_VERSION_MAJOR >= 15
+    return PointerType::getUnqual(context);
+#else
+    return PointerType::getUnqual(Type::getInt8Ty(context));
+#endif
+}
+
+//calls may free (or realloc) the memory a check vouched for, intrinsics never do
+bool mayFree(const Instruction & inst)
+{
+    const CallBase * call = dyn_cast<CallBase>(&inst);
+    return call && !isa<IntrinsicInst>(call);
+}
+
+bool loopMayFree(const Loop * loop)
+{
+    for(const BasicBlock * block : loop->blocks())
+    {
+        for(const Instruction & inst : *block)
+        {
+            if(mayFree(inst))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//loads and stores that could touch a mallocSafe block
+void collectAccesses(Function & function, const DataLayout & layout, std::vector<access> & accesses)
+{
+    for(BasicBlock & block : function)
+    {
+        for(Instruction & inst : block)
+        {
+            Value * ptr;
+            Type * type;
+
+            if(LoadInst * load = dyn_cast<LoadInst>(&inst))
+            {
+                ptr = load->getPointerOperand();
+                type = load->getType();
+            }
+            else if(StoreInst * store = dyn_cast<StoreInst>(&inst))
+            {
+                ptr = store->getPointerOperand();
+                type = store->getValueOperand()->getType();
+            }
+            else
+            {
+                continue;
+            }
+
+            if(ptr->getType()->getPointerAddressSpace() != 0)
+            {
+                continue;
+            }
+
+            //stack and global objects are never heap blocks
+            const Value * object = getUnderlyingObject(ptr);
+            if(isa<AllocaInst>(object) || isa<GlobalValue>(object))
+            {
+                continue;
+            }
+
+            TypeSize size = layout.getTypeStoreSize(type);
+            if(size.isScalable())
+            {
+                continue;
+            }
+
+            accesses.push_back({&inst, ptr, size.getFixedValue()});
+        }
+    }
+}
+
+//emits the memcheckSafeFast fast path inline before inst: compare against safeCheckCache, call memcheckSafeRefill on a miss
+void emitCheck(const check & c, GlobalVariable * cache, GlobalVariable * generations, FunctionCallee refill, Type * intPtrType)
+{
+    LLVMContext & context = c.inst->getContext();
+    Type * bytePtrType = bytePointerType(context);
+    Type * cacheType = cache->getValueType();
+    IRBuilder<> builder(c.inst);
+
+    Value * ptr = builder.CreatePointerCast(c.ptr, bytePtrType);
+    Value * start = builder.CreateLoad(bytePtrType, builder.CreateStructGEP(cacheType, cache, 0), "safecheck.start");
+    Value * end = builder.CreateLoad(bytePtrType, builder.CreateStructGEP(cacheType, cache, 1), "safecheck.end");
+    Value * generation = builder.CreateLoad(intPtrType, builder.CreateStructGEP(cacheType, cache, 2), "safecheck.gen");
+    Value * slot = builder.CreateLoad(builder.getInt32Ty(), builder.CreateStructGEP(cacheType, cache, 3), "safecheck.slot");
+    Value * current = builder.CreateLoad(intPtrType,
+                                         builder.CreateInBoundsGEP(generations->getValueType(), generations,
+                                                                   {builder.getInt64(0), builder.CreateZExt(slot, builder.getInt64Ty())}),
+                                         "safecheck.curgen");
+
+    Value * p = builder.CreatePtrToInt(ptr, intPtrType);
+    Value * s = builder.CreatePtrToInt(start, intPtrType);
+    Value * e = builder.CreatePtrToInt(end, intPtrType);
+    Value * size = builder.CreateZExtOrTrunc(c.size, intPtrType);
+
+    Value * covered = builder.CreateAnd(builder.CreateAnd(builder.CreateICmpUGE(p, s), builder.CreateICmpULE(p, e)),
+                                        builder.CreateAnd(builder.CreateICmpULE(size, builder.CreateSub(e, p)),
+                                                          builder.CreateICmpEQ(generation, current)));
+
+    MDNode * unlikely = MDBuilder(context).createBranchWeights(1, 100000);
+    Instruction * miss = SplitBlockAndInsertIfThen(builder.CreateNot(covered), c.inst, false, unlikely);
+    IRBuilder<> missBuilder(miss);
+    missBuilder.CreateCall(refill, {ptr, size});
+}
+
+
+PreservedAnalyses SafeCheckPass::run(Function & function, FunctionAnalysisManager & analyses)
+{
+    if(function.isDeclaration() || isRuntimeFunction(function))
+    {
+        return PreservedAnalyses::all();
+    }
+
+    Module & module = *function.getParent();
+    const DataLayout & layout = module.getDataLayout();
+    LLVMContext & context = module.getContext();
+    Type * intPtrType = layout.getIntPtrType(context);
+
+    std::vector<access> accesses;
+    collectAccesses(function, layout, accesses);
+    if(accesses.empty())
+    {
+        return PreservedAnalyses::all();
+    }
+
+    LoopInfo & loops = analyses.getResult<LoopAnalysis>(function);
+    ScalarEvolution & scev = analyses.getResult<ScalarEvolutionAnalysis>(function);
+    DominatorTree & dominators = analyses.getResult<DominatorTreeAnalysis>(function);
+
+    std::vector<check> checks;
+    SmallPtrSet<Instruction *, 32> hoisted;
+    std::set<std::tuple<const Loop *, const SCEV *, const SCEV *>> hoistedRanges;
+    DenseMap<const Loop *, bool> loopFrees;
+    SCEVExpander expander(scev, layout, "safecheck");
+
+    //loop hoisting - one check in the preheader for every byte a contiguous walk will touch
+    for(const access & a : accesses)
+    {
+        BasicBlock * block = a.inst->getParent();
+        Loop * loop = loops.getLoopFor(block);
+        if(!loop || !loop->getLoopPreheader() || !loop->getLoopLatch())
+        {
+            continue;
+        }
+
+        const SCEVAddRecExpr * walk = dyn_cast<SCEVAddRecExpr>(scev.getSCEV(a.ptr));
+        if(!walk || walk->getLoop() != loop || !walk->isAffine())
+        {
+            continue;
+        }
+
+        const SCEVConstant * step = dyn_cast<SCEVConstant>(walk->getStepRecurrence(scev));
+        if(!step || step->getAPInt().abs() != a.size)
+        {
+            continue;
+        }
+
+        const SCEV * backedges = scev.getBackedgeTakenCount(loop);
+        if(isa<SCEVCouldNotCompute>(backedges))
+        {
+            continue;
+        }
+
+        //the access has to happen on every iteration, or the range would cover bytes the loop never touches
+        SmallVector<BasicBlock *, 4> exits;
+        loop->getExitingBlocks(exits);
+        bool everyIteration = dominators.dominates(block, loop->getLoopLatch());
+        for(BasicBlock * exit : exits)
+        {
+            everyIteration = everyIteration && dominators.dominates(block, exit);
+        }
+        if(!everyIteration)
+        {
+            continue;
+        }
+
+        auto frees = loopFrees.find(loop);
+        if(frees == loopFrees.end())
+        {
+            frees = loopFrees.insert({loop, loopMayFree(loop)}).first;
+        }
+        if(frees->second)
+        {
+            continue;
+        }
+
+        //lowest address touched, and iterations * access size bytes from there
+        const SCEV * iterations = scev.getAddExpr(scev.getTruncateOrZeroExtend(backedges, intPtrType), scev.getOne(intPtrType));
+        const SCEV * bytes = scev.getMulExpr(iterations, scev.getConstant(intPtrType, a.size));
+        const SCEV * low = step->getAPInt().isNegative() ? walk->evaluateAtIteration(backedges, scev) : walk->getStart();
+
+        Instruction * preheaderEnd = loop->getLoopPreheader()->getTerminator();
+#if LLVM_VERSION_MAJOR >= 15
+        bool expandable = expander.isSafeToExpandAt(low, preheaderEnd) && expander.isSafeToExpandAt(bytes, preheaderEnd);
+#else
+        bool expandable = isSafeToExpandAt(low, preheaderEnd, scev) && isSafeToExpandAt(bytes, preheaderEnd, scev);
+#endif
+        if(!expandable)
+        {
+            continue;
+        }
+
+        hoisted.insert(a.inst);
+        if(!hoistedRanges.insert(std::make_tuple(loop, low, bytes)).second)
+        {
+            continue; //same range is already checked
+        }
+
+        Value * lowValue = expander.expandCodeFor(low, a.ptr->getType(), preheaderEnd);
+        Value * bytesValue = expander.expandCodeFor(bytes, intPtrType, preheaderEnd);
+        checks.push_back({preheaderEnd, lowValue, bytesValue});
+    }
+
+    //coalescing - constant-offset accesses from the same base between two calls share one check
+    DenseMap<Instruction *, const access *> accessOf;
+    for(const access & a : accesses)
+    {
+        if(!hoisted.count(a.inst))
+        {
+            accessOf[a.inst] = &a;
+        }
+    }
+
+    for(BasicBlock & block : function)
+    {
+        SmallVector<accessGroup, 8> groups;
+        auto flush = [&]()
+        {
+            for(const accessGroup & group : groups)
+            {
+                IRBuilder<> builder(group.first);
+                Value * base = builder.CreatePointerCast(group.base, bytePointerType(context));
+                Value * ptr = builder.CreateInBoundsGEP(builder.getInt8Ty(), base, builder.getInt64(group.low));
+                checks.push_back({group.first, ptr, ConstantInt::get(intPtrType, group.high - group.low)});
+            }
+            groups.clear();
+        };
+
+        for(Instruction & inst : block)
+        {
+            if(mayFree(inst))
+            {
+                flush();
+                continue;
+            }
+
+            auto found = accessOf.find(&inst);
+            if(found == accessOf.end())
+            {
+                continue;
+            }
+
+            const access & a = *found->second;
+            int64_t offset = 0;
+            Value * base = GetPointerBaseWithConstantOffset(a.ptr, offset, layout);
+
+            accessGroup * group = nullptr;
+            for(accessGroup & g : groups)
+            {
+                if(g.base == base)
+                {
+                    group = &g;
+                }
+            }
+
+            if(group)
+            {
+                group->low = std::min(group->low, offset);
+                group->high = std::max(group->high, offset + (int64_t)a.size);
+            }
+            else
+            {
+                groups.push_back({base, offset, offset + (int64_t)a.size, &inst});
+            }
+        }
+        flush();
+    }
+
+    if(checks.empty())
+    {
+        return PreservedAnalyses::all();
+    }
+
+    //runtime symbols from Safemalloc.h - reuse the module's own declarations when the file includes the header
+    StructType * spanType = StructType::getTypeByName(context, "struct.safeSpan");
+    if(!spanType)
+    {
+        spanType = StructType::create(context, {bytePointerType(context), bytePointerType(context), intPtrType, Type::getInt32Ty(context)},
+                                      "struct.safeSpan");
+    }
+
+    GlobalVariable * cache = module.getGlobalVariable("safeCheckCache");
+    if(!cache)
+    {
+        cache = new GlobalVariable(module, spanType, false, GlobalValue::ExternalLinkage, nullptr, "safeCheckCache");
+    }
+
+    GlobalVariable * generations = module.getGlobalVariable("safeSpanGenerations");
+    if(!generations)
+    {
+        generations = new GlobalVariable(module, ArrayType::get(intPtrType, SAFE_SPAN_SLOTS), false, GlobalValue::ExternalLinkage, nullptr,
+                                         "safeSpanGenerations");
+    }
+
+    FunctionCallee refill = module.getOrInsertFunction("memcheckSafeRefill", Type::getVoidTy(context),
+                                                       bytePointerType(context), intPtrType);
+
+    for(const check & c : checks)
+    {
+        emitCheck(c, cache, generations, refill, intPtrType);
+    }
+
+    return PreservedAnalyses::none();
+}
+
+//loops need a preheader for checks to be hoisted into, so they are put in simplified form first
+void addSafeCheckPasses(FunctionPassManager & passes)
+{
+    passes.addPass(LoopSimplifyPass());
+    passes.addPass(SafeCheckPass());
+}
+
+} // namespace
+
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+    return {LLVM_PLUGIN_API_VERSION, "SafeCheck", "1.0", [](PassBuilder & builder)
+    {
+        //opt -passes=safecheck
+        builder.registerPipelineParsingCallback([](StringRef name, FunctionPassManager & passes, ArrayRef<PassBuilder::PipelineElement>)
+        {
+            if(name == "safecheck")
+            {
+                addSafeCheckPasses(passes);
+                return true;
+            }
+            return false;
+        });
+
+        //clang -fpass-plugin - run after optimization so checks land on the loads and stores that are actually left
+#if LLVM_VERSION_MAJOR >= 20
+        builder.registerOptimizerLastEPCallback([](ModulePassManager & passes, OptimizationLevel, ThinOrFullLTOPhase)
+#else
+        builder.registerOptimizerLastEPCallback([](ModulePassManager & passes, OptimizationLevel)
+#endif
+        {
+            FunctionPassManager functionPasses;
+            addSafeCheckPasses(functionPasses);
+            passes.addPass(createModuleToFunctionPassAdaptor(std::move(functionPasses)));
+        });
+    }};
+}
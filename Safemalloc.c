@@ -1,24 +1,413 @@
+#define _GNU_SOURCE     //for mremap
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include "Safemalloc.h"
 #include "rangeTree.h"
+#include "safeProbes.h"
 
 //static tree root
 static node * root = NULL;
 
+//per-tag totals - each tag's counters sit on their own cache line so updates to one tag never contend with another
+typedef union tagCounter
+{
+    tagStats stats;
+    char pad[SAFE_CACHE_LINE];
+    
+} tagCounter;
+
+static tagCounter tagCounters[SAFE_MAX_TAGS] __attribute__((aligned(SAFE_CACHE_LINE)));
+
+
+//exits if the tag is outside of the range that has counters
+static void checkTagValid(unsigned int tag, const char * caller)
+{
+    if(tag >= SAFE_MAX_TAGS)
+    {
+        fprintf(stderr, "Error: %s called with tag %u, but tags must be less than %i.\n", caller, tag, SAFE_MAX_TAGS);
+        fprintf(stderr, "       Exiting.\n");
+        exit(-1);
+    }
+}
+
+//checks that the tag can hold liveBytes bytes - going over the hard budget is fatal, going over the soft budget only warns
+//(and only when the tag first crosses it, so a tag that stays above its soft budget doesn't flood stderr)
+static void checkTagBudget(unsigned int tag, size_t liveBytes, const char * caller)
+{
+    tagStats * stats = &tagCounters[tag].stats;
+    
+    if(stats->hardBudget != 0 && liveBytes > stats->hardBudget)
+    {
+        fprintf(stderr, "Error: %s exceeded the hard budget for tag %u.\n", caller, tag);
+        fprintf(stderr, "       Tag would hold %zu bytes when its hard budget is %zu bytes.\n", liveBytes, stats->hardBudget);
+        fprintf(stderr, "       Exiting.\n");
+        exit(-1);
+    }
+    
+    if(stats->softBudget != 0 && liveBytes > stats->softBudget && stats->liveBytes <= stats->softBudget)
+    {
+        fprintf(stderr, "Warning: %s exceeded the soft budget for tag %u (%zu bytes, soft budget is %zu bytes).\n", 
+                caller, tag, liveBytes, stats->softBudget);
+    }
+}
+
+//account a block under its tag
+static void addTagBytes(unsigned int tag, size_t size)
+{
+    tagCounters[tag].stats.liveBytes += size;
+    tagCounters[tag].stats.liveCount++;
+}
+
+//stop accounting a block under its tag
+static void removeTagBytes(unsigned int tag, size_t size)
+{
+    tagCounters[tag].stats.liveBytes -= size;
+    tagCounters[tag].stats.liveCount--;
+}
+
+static void *mallocTagged(size_t size, unsigned int tag, const char * caller);
+static void *reallocTagged(void *ptr, size_t size, unsigned int tag, int keepTag);
+
+
+//block generations for checked spans - a block's slot is bumped whenever freeSafe or reallocSafe changes the block,
+//which sends spans acquired on it back through a full tree check (blocks sharing a slot only cost an extra check)
+unsigned long safeSpanGenerations[SAFE_SPAN_SLOTS];
+
+//block last found by memcheckSafeRefill (starts out empty, so the first memcheckSafeFast always misses)
+safeSpan safeCheckCache;
+
+//slot of the block starting at blockStart
+static unsigned int spanSlot(void * blockStart)
+{
+    return (unsigned int)((((uintptr_t)blockStart >> 4) * 2654435761u) % SAFE_SPAN_SLOTS);
+}
+
+//invalidate every span acquired on the block starting at blockStart
+static void bumpGeneration(void * blockStart)
+{
+    safeSpanGenerations[spanSlot(blockStart)]++;
+}
+
+
+//blocks of at least this many bytes are mapped directly with a guard page behind them (0 = never)
+static size_t mmapThreshold = SAFE_MMAP_THRESHOLD;
+
+//freed large blocks that are kept mapped PROT_NONE so late accesses fault - oldest one is unmapped when the ring is full
+static void * quarantineBase[SAFE_MMAP_QUARANTINE_MAX];
+static size_t quarantineLength[SAFE_MMAP_QUARANTINE_MAX];
+static int quarantineLimit = 0;
+static int quarantineNext = 0;
+
+//freed heap blocks that haven't been passed to free yet, oldest first - the oldest ones are freed when the ring is full
+//or would hold more than SAFE_FREE_QUARANTINE_BYTES
+static void * heldBase[SAFE_FREE_QUARANTINE];
+static size_t heldSize[SAFE_FREE_QUARANTINE];
+static int heldOldest = 0;
+static int heldCount = 0;
+static size_t heldBytes = 0;
+
+
+//rounds size up to a whole number of pages
+static size_t pageRoundUp(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+//maps a block of size bytes at the start of its own mapping, followed by a PROT_NONE guard page
+//so running off the end of the block (past the page rounding) faults straight away
+static void * mapLargeBlock(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t dataLength = pageRoundUp(size);
+    
+    char * base = mmap(NULL, dataLength + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+    {
+        return NULL;
+    }
+    
+    if(mprotect(base + dataLength, page, PROT_NONE) != 0)
+    {
+        munmap(base, dataLength + page);
+        return NULL;
+    }
+    
+    return base;
+}
+
+//resizes a mapped block with mremap, so the contents are never copied - returns NULL on failure
+static void * remapLargeBlock(void * ptr, size_t oldSize, size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t oldLength = pageRoundUp(oldSize);
+    size_t newLength = pageRoundUp(size);
+    
+    if(oldLength == newLength) //still fits in the same pages
+    {
+        return ptr;
+    }
+    
+    //open the old guard page first so the whole mapping is one region that mremap can resize
+    if(mprotect((char*)ptr + oldLength, page, PROT_READ | PROT_WRITE) != 0)
+    {
+        return NULL;
+    }
+    
+    char * base = mremap(ptr, oldLength + page, newLength + page, MREMAP_MAYMOVE);
+    if(base == MAP_FAILED)
+    {
+        return NULL;
+    }
+    
+    //put the guard page back at the new end of the block
+    if(mprotect(base + newLength, page, PROT_NONE) != 0)
+    {
+        return NULL;
+    }
+    
+    return base;
+}
+
+//unmaps a freed mapped block, or keeps it mapped PROT_NONE in the quarantine ring if quarantining is on
+static void releaseLargeBlock(void * ptr, size_t size)
+{
+    size_t length = pageRoundUp(size) + (size_t)sysconf(_SC_PAGESIZE);
+    
+    if(quarantineLimit == 0)
+    {
+        munmap(ptr, length);
+        return;
+    }
+    
+    mprotect(ptr, length, PROT_NONE);
+    
+    //evict the oldest quarantined block if this slot is taken
+    if(quarantineBase[quarantineNext] != NULL)
+    {
+        munmap(quarantineBase[quarantineNext], quarantineLength[quarantineNext]);
+    }
+    
+    quarantineBase[quarantineNext] = ptr;
+    quarantineLength[quarantineNext] = length;
+    quarantineNext = (quarantineNext + 1) % quarantineLimit;
+}
+
+//passes the oldest held block to free
+static void releaseOldestHeld(void)
+{
+    free(heldBase[heldOldest]);
+    heldBytes -= heldSize[heldOldest];
+    heldBase[heldOldest] = NULL;
+    heldOldest = (heldOldest + 1) % SAFE_FREE_QUARANTINE;
+    heldCount--;
+}
+
+//holds a freed heap block back from free, so it isn't handed out by malloc (to mallocSafe or to uninstrumented code)
+//until enough blocks or bytes have been freed after it - blocks too big for the byte limit are freed straight away
+static void holdFreedBlock(void * ptr, size_t size)
+{
+    if(size > SAFE_FREE_QUARANTINE_BYTES)
+    {
+        free(ptr);
+        return;
+    }
+    
+    while(heldCount == SAFE_FREE_QUARANTINE || heldBytes + size > SAFE_FREE_QUARANTINE_BYTES)
+    {
+        releaseOldestHeld();
+    }
+    
+    int slot = (heldOldest + heldCount) % SAFE_FREE_QUARANTINE;
+    heldBase[slot] = ptr;
+    heldSize[slot] = size;
+    heldCount++;
+    heldBytes += size;
+}
+
+//returns 1 if ptr is in a freed block that is still held back from malloc or still mapped PROT_NONE,
+//i.e. a freed block nothing else can have been given since
+static int isQuarantined(void * ptr)
+{
+    char * p = (char*)ptr;
+    
+    for(int i = 0; i < SAFE_FREE_QUARANTINE; i++)
+    {
+        if(heldBase[i] != NULL && p >= (char*)heldBase[i] && p < (char*)heldBase[i] + heldSize[i])
+        {
+            return 1;
+        }
+    }
+    
+    for(int i = 0; i < quarantineLimit; i++)
+    {
+        if(quarantineBase[i] != NULL && p >= (char*)quarantineBase[i] && p < (char*)quarantineBase[i] + quarantineLength[i])
+        {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+//puts a node for [start, start + size) back into the tree with the given flags
+static void insertPiece(void * start, size_t size, node * flagsFrom)
+{
+    node * piece = createNode(start, size, flagsFrom->tag);
+    piece->freed = flagsFrom->freed;
+    piece->mapped = flagsFrom->mapped;
+    root = insertNodeStruct(root, piece);
+}
+
+//removes every (freed) node that overlaps the block [ptr, ptr + size) from the tree - a (coalesced) node that only
+//partly overlaps is split, and the parts before and after the block go back in
+static void removeOverlappingNodes(void * ptr, size_t size)
+{
+    node * nodeToDelete = NULL;
+    checkTreeBlockBounds(root, ptr, size, &nodeToDelete); //identify the nodes to delete and place them into the nodesToDelete list
+    
+    //iterate through nodesToDelete and delete... the... nodes....... to delete :-)
+    while(nodeToDelete != NULL)
+    {
+        char * start = (char*)nodeToDelete->addrRange->start;
+        char * end = start + nodeToDelete->addrRange->end;
+        
+        root = removeNode(root, start);
+        
+        if(start < (char*)ptr) //part before the new block
+        {
+            insertPiece(start, (char*)ptr - start, nodeToDelete);
+        }
+        if(end > (char*)ptr + size) //part after the new block
+        {
+            insertPiece((char*)ptr + size, end - ((char*)ptr + size), nodeToDelete);
+        }
+        
+        //the list holds copies, so free this one
+        node * tempNode = nodeToDelete->right;
+        freeNode(nodeToDelete);
+        nodeToDelete = tempNode;
+    }
+}
+
+//merges the just freed block [start, start + size) with the freed blocks right before and after it, so a run of frees
+//leaves a single node behind instead of one per block. malloc never hands out byte-adjacent blocks (each one is preceded
+//by a chunk header, and sizes are rounded up), so neighbours up to SAFE_COALESCE_GAP bytes apart are merged along with
+//the gap - they are next to each other in the tree, so no tracked block is in between, and the gap is too small for an
+//untracked one
+static void coalesceFreedNode(void * start, size_t size)
+{
+    char * low = (char*)start;
+    char * high = (char*)start + size;
+    void * beforeKey = NULL;
+    void * afterKey = NULL;
+    
+    node * before = predecessorNode(root, start);
+    if(before && before->freed && (char*)before->addrRange->start + before->addrRange->end + SAFE_COALESCE_GAP >= low)
+    {
+        beforeKey = before->addrRange->start;
+        low = (char*)beforeKey;
+        if((char*)beforeKey + before->addrRange->end > high)
+        {
+            high = (char*)beforeKey + before->addrRange->end;
+        }
+    }
+    
+    node * after = successorNode(root, start);
+    if(after && after->freed && (char*)after->addrRange->start <= high + SAFE_COALESCE_GAP)
+    {
+        afterKey = after->addrRange->start;
+        if((char*)afterKey + after->addrRange->end > high)
+        {
+            high = (char*)afterKey + after->addrRange->end;
+        }
+    }
+    
+    if(!beforeKey && !afterKey) //no freed neighbours
+    {
+        return;
+    }
+    
+    //removals can move node contents around, so everything is removed by address and the merged node is made fresh
+    root = removeNode(root, start);
+    if(beforeKey)
+    {
+        root = removeNode(root, beforeKey);
+    }
+    if(afterKey)
+    {
+        root = removeNode(root, afterKey);
+    }
+    
+    node * merged = createNode(low, high - low, 0);
+    merged->freed = 1;
+    root = insertNodeStruct(root, merged);
+}
+
+
+//frees the block of a live node for freeSafe and reallocSafe(ptr, 0) - marks the node freed, then the real free
+//happens once the block leaves the quarantine (or the mapping of a large block is dropped) - returns the block's size
+static size_t releaseBlock(node * matchingNode)
+{
+    void * ptr = matchingNode->addrRange->start;
+    size_t size = matchingNode->addrRange->end;
+    
+    //you'll need mark the node as free
+    matchingNode->freed = 1; 
+    bumpGeneration(ptr);
+    removeTagBytes(matchingNode->tag, size);
+    
+    if(matchingNode->mapped)
+    {
+        releaseLargeBlock(ptr, size);
+    }
+    else
+    {
+        holdFreedBlock(ptr, size);
+    }
+    
+    coalesceFreedNode(ptr, size); //may free matchingNode
+    return size;
+}
+
 
 /* mallocSafe */
 void *mallocSafe(size_t size)
 {
+    return mallocTagged(size, 0, "mallocSafe");
+}
+
+
+/* mallocSafeTagged */
+void *mallocSafeTagged(size_t size, unsigned int tag)
+{
+    checkTagValid(tag, "mallocSafeTagged");
+    return mallocTagged(size, tag, "mallocSafeTagged");
+}
+
+
+//shared malloc path - caller is the entry point the user called, for the budget messages
+static void *mallocTagged(size_t size, unsigned int tag, const char * caller)
+{
+    SAFE_PROBE2(malloc_entry, size, tag);
+    
     if(size == 0)
     {
         fprintf(stderr, "Warning: Allocating memory of size 0.\n");
     }
     
-    void* pointer = (void*)malloc(size); //pointer holds the address --> printf("address of this pointer is: %p\n", &pointer); //can compare simply with < and >
-                                         //we already have the size 
-                                         //both of these need to be added to a tuple to go into the range tree
+    //fail before calling malloc if this block would put the tag over its hard budget
+    checkTagBudget(tag, tagCounters[tag].stats.liveBytes + size, caller);
+    
+    //large blocks get their own mapping with a guard page, everything else comes from malloc
+    int mapped = (mmapThreshold != 0 && size >= mmapThreshold);
+    void* pointer = mapped ? mapLargeBlock(size) : (void*)malloc(size); //pointer holds the address --> printf("address of this pointer is: %p\n", &pointer); //can compare simply with < and >
+                                                                        //we already have the size 
+                                                                        //both of these need to be added to a tuple to go into the range tree
     
     if(!pointer) //check that malloc was successful
     {
@@ -37,18 +426,14 @@ void *mallocSafe(size_t size)
         }
         
         //add this node to the range tree
-        node * nodeToDelete = NULL;
-        checkTreeBlockBounds(root, pointer, size, &nodeToDelete); //identify the nodes to delete and place them into the nodesToDelete list
-        
-        //iterate through nodesToDelete and delete... the... nodes....... to delete :-)
-        while(nodeToDelete != NULL)
-        {
-            root = removeNode(root, nodeToDelete->addrRange->start);
-            nodeToDelete = nodeToDelete->right;
-        }
+        removeOverlappingNodes(pointer, size);
         
         //now that the tree is cleared of any old freed overlapping nodes, you can continue 
-        root = insertNode(root, pointer, size);    
+        node * newNode = createNode(pointer, size, tag);
+        newNode->mapped = mapped;
+        root = insertNodeStruct(root, newNode);
+        addTagBytes(tag, size);
+        SAFE_PROBE2(malloc_return, pointer, size);
         return pointer; 
     }
 }
@@ -59,6 +444,8 @@ void *mallocSafe(size_t size)
 /* freeSafe */
 void freeSafe(void *ptr)
 {  
+    SAFE_PROBE1(free_entry, ptr);
+    
     if(ptr == NULL)
     {
         fprintf(stderr, "Error: freeSafe is called on a null pointer.\n");
@@ -69,11 +456,8 @@ void freeSafe(void *ptr)
     node * matchingNode = checkTreeContainsPtr(root, ptr, 1); //will check errors
     if(matchingNode)
     {
-        //you'll need mark the node as free
-        matchingNode->freed = 1; 
-        
-        //call the real free
-        free(ptr);
+        size_t size = releaseBlock(matchingNode);
+        SAFE_PROBE2(free_return, ptr, size);
     }
     else //the node wasn't found
     {
@@ -90,9 +474,29 @@ void freeSafe(void *ptr)
 /* reallocSafe  - change size of this ptr in the range tree*/
 void *reallocSafe(void *ptr, size_t size)
 {
+    return reallocTagged(ptr, size, 0, 1);
+}
+
+
+/* reallocSafeTagged */
+void *reallocSafeTagged(void *ptr, size_t size, unsigned int tag)
+{
+    checkTagValid(tag, "reallocSafeTagged");
+    return reallocTagged(ptr, size, tag, 0);
+}
+
+
+//shared realloc path - keepTag leaves the block under the tag it already has, otherwise it moves to tag
+static void *reallocTagged(void *ptr, size_t size, unsigned int tag, int keepTag)
+{
+    SAFE_PROBE2(realloc_entry, ptr, size);
+    const char * caller = keepTag ? "reallocSafe" : "reallocSafeTagged";
+    
     if(!ptr) //if NULL
     {
-        return mallocSafe(size);
+        void * pointer = mallocTagged(size, tag, caller);
+        SAFE_PROBE3(realloc_return, ptr, pointer, size);
+        return pointer;
     }
     else if(size == 0)
     {
@@ -103,11 +507,9 @@ void *reallocSafe(void *ptr, size_t size)
         node * matchingNode = checkTreeContainsPtr(root, ptr, 2);    
         if(matchingNode)
         {
-            //you'll need mark the node as free
-            matchingNode->freed = 1; 
-            
-            //call the real free
-            return realloc(ptr,0);
+            releaseBlock(matchingNode);
+            SAFE_PROBE3(realloc_return, ptr, NULL, size);
+            return NULL;
         }
         else //the node wasn't found
         {        
@@ -121,7 +523,8 @@ void *reallocSafe(void *ptr, size_t size)
     else
     {
         //check tree to make sure it actually contains this pointer to reallocate to begin with 
-        if(!checkTreeContainsPtr(root, ptr, 2))
+        node * matchingNode = checkTreeContainsPtr(root, ptr, 2);
+        if(!matchingNode)
         {
             fprintf(stderr, "Error: reallocSafe call made on a pointer that was not allocated by mallocSafe.\n");
             fprintf(stderr, "       Faulty call was on pointer with address %p\n", (void*)ptr);
@@ -129,8 +532,36 @@ void *reallocSafe(void *ptr, size_t size)
             exit(-1);
         }
         
-        //call realloc
-        void * pointer = realloc(ptr, size);
+        //the block's bytes move from its old tag to its new one - check the new tag's budget before calling realloc
+        size_t oldSize = matchingNode->addrRange->end;
+        unsigned int oldTag = matchingNode->tag;
+        if(keepTag)
+        {
+            tag = oldTag;
+        }
+        checkTagBudget(tag, tagCounters[tag].stats.liveBytes + size - (tag == oldTag ? oldSize : 0), caller);
+        
+        //call realloc - mapped blocks are resized with mremap, and heap blocks that grow past the threshold move to a mapping
+        void * pointer;
+        int mapped = matchingNode->mapped;
+        if(mapped)
+        {
+            pointer = remapLargeBlock(ptr, oldSize, size);
+        }
+        else if(mmapThreshold != 0 && size >= mmapThreshold)
+        {
+            mapped = 1;
+            pointer = mapLargeBlock(size);
+            if(pointer)
+            {
+                memcpy(pointer, ptr, oldSize < size ? oldSize : size); //the block may be shrinking after the threshold was lowered
+                free(ptr);
+            }
+        }
+        else
+        {
+            pointer = realloc(ptr, size);
+        }
         
         //need to do the same tree update we did for malloc here!
         if(!pointer) //check that realloc was successful
@@ -138,45 +569,199 @@ void *reallocSafe(void *ptr, size_t size)
             fprintf(stderr, "Error: Memory reallocaion failed. Exiting.\n");
             exit(EXIT_FAILURE);
         }
-        else
+        
+        //the block changed size or moved, so spans on it have to re-check
+        bumpGeneration(ptr);
+        
+        if(mapped && pointer == ptr)
         {
-            //add this node to the range tree          
-            
-            node * nodeToDelete = NULL;
-            
-            checkTreeBlockBounds(root, pointer, size, &nodeToDelete); //identify the nodes to delete and place them into the nodesToDelete list
-                                                                     //most importantly, this will remove the node that we are reallocating!
-            
-            //iterate through nodesToDelete and delete... the... nodes....... to delete :-)
-            while(nodeToDelete != NULL)
+            //any stale freed nodes in the bytes the block grew into have to go - while the block's own node still ends before them
+            if(size > oldSize)
             {
-                root = removeNode(root, nodeToDelete->addrRange->start);
-                
-                //free node that you just deleted
-                node * tempNode = nodeToDelete->right;
-                free(nodeToDelete->addrRange);
-                free(nodeToDelete);
-                nodeToDelete = NULL;
-                
-                nodeToDelete = tempNode;
+                removeOverlappingNodes((char*)ptr + oldSize, size - oldSize);
+                matchingNode = checkTreeContainsPtr(root, ptr, 0); //removals can move node contents around
             }
             
+            //mremap resized the block in place - the existing node just gets its new extent
+            matchingNode->addrRange->end = size;
+            matchingNode->tag = tag;
+            removeTagBytes(oldTag, oldSize);
+            addTagBytes(tag, size);
+            SAFE_PROBE3(realloc_return, ptr, pointer, size);
+            return pointer;
+        }
+        else
+        {
+            //the old block is gone either way - if realloc moved it, its node stays behind as a freed block,
+            //otherwise the overlap check below removes it
+            matchingNode->freed = 1;
+            removeTagBytes(oldTag, oldSize);
+            addTagBytes(tag, size);
+            coalesceFreedNode(ptr, oldSize);
+            
+            //add this node to the range tree - most importantly, this will remove the node that we are reallocating
+            //if realloc kept the address
+            removeOverlappingNodes(pointer, size);
             
             //now that the tree is cleared of any old freed overlapping nodes, you can continue 
-            root = insertNode(root, pointer, size);
+            node * newNode = createNode(pointer, size, tag);
+            newNode->mapped = mapped;
+            root = insertNodeStruct(root, newNode);
+            SAFE_PROBE3(realloc_return, ptr, pointer, size);
             return pointer;
         }
     }
 
 }
 
+/* setMmapThresholdSafe */
+void setMmapThresholdSafe(size_t threshold)
+{
+    mmapThreshold = threshold;
+}
+
+/* setMmapQuarantineSafe - shrinking or growing the ring unmaps whatever it held */
+void setMmapQuarantineSafe(int count)
+{
+    int i;
+    
+    if(count < 0 || count > SAFE_MMAP_QUARANTINE_MAX)
+    {
+        fprintf(stderr, "Error: setMmapQuarantineSafe called with %i blocks, but at most %i blocks can be quarantined.\n", 
+                count, SAFE_MMAP_QUARANTINE_MAX);
+        fprintf(stderr, "       Exiting.\n");
+        exit(-1);
+    }
+    
+    for(i = 0; i < SAFE_MMAP_QUARANTINE_MAX; i++)
+    {
+        if(quarantineBase[i] != NULL)
+        {
+            munmap(quarantineBase[i], quarantineLength[i]);
+            quarantineBase[i] = NULL;
+        }
+    }
+    
+    quarantineLimit = count;
+    quarantineNext = 0;
+}
+
+/* setTagBudgetSafe */
+void setTagBudgetSafe(unsigned int tag, size_t softBudget, size_t hardBudget)
+{
+    checkTagValid(tag, "setTagBudgetSafe");
+    
+    tagCounters[tag].stats.softBudget = softBudget;
+    tagCounters[tag].stats.hardBudget = hardBudget;
+}
+
+/* getTagStatsSafe - one copy per tag, no tree walk needed */
+int getTagStatsSafe(tagStats * stats, int maxTags)
+{
+    int i;
+    
+    if(maxTags > SAFE_MAX_TAGS)
+    {
+        maxTags = SAFE_MAX_TAGS;
+    }
+    
+    for(i = 0; i < maxTags; i++)
+    {
+        stats[i] = tagCounters[i].stats;
+    }
+    
+    return i;
+}
+
+/* isAllocatedSafe - plain lookup with no error output */
+int isAllocatedSafe(void *ptr)
+{
+    return checkTreeContainsPtr(root, ptr, 0) != NULL;
+}
+
+/* getTreeSizeSafe */
+int getTreeSizeSafe(void)
+{
+    return countNodes(root);
+}
+
+/* isTrackedSafe - plain lookup with no error output, for ranges that may start anywhere inside a block */
+int isTrackedSafe(void *ptr, size_t size)
+{
+    node * block = findTreeBlock(root, ptr, size);
+    return block != NULL && !block->freed;
+}
+
+//fills span with the bounds and current generation of block
+static void fillSpan(safeSpan * span, node * block)
+{
+    span->start = (char*)block->addrRange->start;
+    span->end = (char*)block->addrRange->start + block->addrRange->end;
+    span->slot = spanSlot(block->addrRange->start);
+    span->generation = safeSpanGenerations[span->slot];
+}
+
+/* safeSpanAcquire - one tree search validates the range and finds the bounds of the block it sits in */
+safeSpan safeSpanAcquire(void *ptr, size_t len)
+{
+    safeSpan span;
+    node * block = findTreeBlock(root, ptr, len);
+    
+    if(!block || block->freed)
+    {
+        memcheckSafe(ptr, len); //reports the error and exits
+    }
+    
+    fillSpan(&span, block);
+    return span;
+}
+
+/* safeSpanRecheck - slow path of the span accessors */
+void *safeSpanRecheck(safeSpan *span, void *ptr, size_t size)
+{
+    //validate like memcheckSafe would, then move the span to whatever block the access is in
+    *span = safeSpanAcquire(ptr, size);
+    return ptr;
+}
+
+/* memcheckSafeRefill - instrumented accesses can't tell heap from stack, so only blocks the tree knows about are judged */
+void memcheckSafeRefill(void *ptr, size_t size)
+{
+    node * block = findTreeBlock(root, ptr, size);
+    if(block && !block->freed)
+    {
+        fillSpan(&safeCheckCache, block);
+        return;
+    }
+    
+    //once the freed block ptr is in has left the quarantine, plain malloc may have handed its memory out again (possibly as
+    //a bigger block than the freed one), so nothing about the access can be judged from the freed node
+    node * holder = block ? block : findTreeBlock(root, ptr, 1);
+    if(holder && holder->freed && !isQuarantined(ptr))
+    {
+        return;
+    }
+    
+    //-1 means no block (live or freed) even starts around this address - not mallocSafe memory, so not ours to report
+    if(checkTreeContainsInterval(root, ptr, size) == -1)
+    {
+        return;
+    }
+    
+    memcheckSafe(ptr, size); //quarantined or overflowing - reports the error and exits
+}
+
 /* memcheckSafe - check that this memory range is contained within the tree*/
 void memcheckSafe(void *ptr, size_t size)
 {
     //check if the tree contains exactly 1 interval that starts with an address >= ptr and ends at an 
     //address <= size so this memory block is neatly fitting in exactly one memory block
     
+    SAFE_PROBE2(memcheck_entry, ptr, size);
+    
     int errorNo = checkTreeContainsInterval(root, ptr, size);
+    SAFE_PROBE3(memcheck_return, ptr, size, errorNo);
+    
     if(errorNo == -1) // -1 means this pointer isn't contained in the tree
     {
         fprintf(stderr, "Error: memcheckSafe identified a faulty memory access.\n");
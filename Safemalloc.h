@@ -1,6 +1,47 @@
 #ifndef MALLOC_H_
 #define MALLOC_H_
 
+#include <stddef.h>
+
+#define SAFE_MAX_TAGS 64        //number of allocation tags (0 .. SAFE_MAX_TAGS-1); untagged calls account under tag 0
+#define SAFE_CACHE_LINE 64      //per-tag counters are padded to this size so neighbouring tags never share a line
+
+#define SAFE_MMAP_THRESHOLD (4 * 1024 * 1024)   //default size at which blocks are mapped directly with a trailing guard page
+#define SAFE_MMAP_QUARANTINE_MAX 64             //most freed mapped blocks that can be kept PROT_NONE at once
+
+#define SAFE_SPAN_SLOTS 1024    //number of block generation slots checked spans are validated against
+#define SAFE_FREE_QUARANTINE 256    //freed heap blocks freeSafe holds back from free, so malloc can't hand them out again yet
+#define SAFE_FREE_QUARANTINE_BYTES (1024 * 1024)    //most bytes held back at once - bigger blocks are freed right away
+#define SAFE_COALESCE_GAP (4 * sizeof(size_t))   //largest gap between freed blocks that are still merged: malloc's chunk
+                                                //header plus alignment padding, too small for another block to sit in
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* tagStats     : Live totals and budgets for one allocation tag. A budget of 0 means no budget is set. */
+typedef struct tagStats
+{
+    size_t liveBytes;      //bytes currently allocated under this tag
+    size_t liveCount;      //number of blocks currently allocated under this tag
+    size_t softBudget;     //exceeding this prints a warning
+    size_t hardBudget;     //exceeding this is reported as an error and the process exits
+    
+} tagStats;
+
+/* safeSpan     : Bounds of one block validated by safeSpanAcquire, plus that block's generation at the time. */
+typedef struct safeSpan
+{
+    char * start;                  //first byte of the block
+    char * end;                    //one past the last byte of the block
+    unsigned long generation;      //generation of the block when the span was validated
+    unsigned int slot;             //generation slot of the block
+    
+} safeSpan;
+
+extern unsigned long safeSpanGenerations[SAFE_SPAN_SLOTS];
+extern safeSpan safeCheckCache;     //last block memcheckSafeFast found, shared by all of its call sites
+
 /* mallocSafe   : Allocates the requested block of memory and records tuple for that memory block. */
 void *mallocSafe(size_t size);
 
@@ -11,7 +52,86 @@ void freeSafe(void *ptr);
                  realloc and replaces tuple if necessary. */
 void *reallocSafe(void *ptr, size_t size);
 
+/* mallocSafeTagged  : Same as mallocSafe, but the block's bytes are accounted under tag and checked against its budgets. */
+void *mallocSafeTagged(size_t size, unsigned int tag);
+
+/* reallocSafeTagged : Same as reallocSafe, but the resulting block is accounted under tag (moving it from its old tag). */
+void *reallocSafeTagged(void *ptr, size_t size, unsigned int tag);
+
+/* setTagBudgetSafe  : Sets the soft and hard byte budgets for tag. Passing 0 for either removes that budget. */
+void setTagBudgetSafe(unsigned int tag, size_t softBudget, size_t hardBudget);
+
+/* getTagStatsSafe   : Copies the totals of tags 0 .. maxTags-1 into stats and returns the number of tags copied. */
+int getTagStatsSafe(tagStats * stats, int maxTags);
+
+/* setMmapThresholdSafe  : Blocks of at least threshold bytes are mapped with mmap, followed by a PROT_NONE guard page,
+                          and resized with mremap. A threshold of 0 sends every block through malloc. */
+void setMmapThresholdSafe(size_t threshold);
+
+/* setMmapQuarantineSafe : Keeps the last count freed mapped blocks mapped PROT_NONE so use after free faults. 0 unmaps them right away. */
+void setMmapQuarantineSafe(int count);
+
+/* isAllocatedSafe   : Returns 1 if ptr is the start of a block allocated with mallocSafe that hasn't been freed, 0 otherwise. */
+int isAllocatedSafe(void *ptr);
+
+/* isTrackedSafe     : Returns 1 if the size bytes at ptr all lie inside one block allocated with mallocSafe that hasn't been freed. */
+int isTrackedSafe(void *ptr, size_t size);
+
+/* getTreeSizeSafe   : Returns the number of nodes (live and freed blocks) in the range tree. */
+int getTreeSizeSafe(void);
+
 /* memcheckSafe : Checks if the address rage specified by the address of ptr + size are within a valid tuple range in the range tree already. */
 void memcheckSafe(void *ptr, size_t size);
 
+/* safeSpanAcquire : Checks the range like memcheckSafe, and returns a span holding the bounds of the block the range is in. */
+safeSpan safeSpanAcquire(void *ptr, size_t len);
+
+/* safeSpanRecheck : Full memcheckSafe-style check of an access the span couldn't vouch for; moves the span to that access's block. */
+void *safeSpanRecheck(safeSpan *span, void *ptr, size_t size);
+
+/* safeSpanCovers  : Returns 1 if size bytes at ptr lie in the span's block and the block hasn't changed since it was validated. */
+static inline int safeSpanCovers(const safeSpan *span, void *ptr, size_t size)
+{
+    char * p = (char*)ptr;
+    return p >= span->start && p <= span->end && size <= (size_t)(span->end - p) 
+           && span->generation == safeSpanGenerations[span->slot];
+}
+
+/* safeSpanAt      : Returns ptr after checking that size bytes at ptr are valid. Accesses inside the span's block are checked
+                     against its cached bounds only, until freeSafe or reallocSafe changes that block. */
+static inline void *safeSpanAt(safeSpan *span, void *ptr, size_t size)
+{
+    if(safeSpanCovers(span, ptr, size))
+    {
+        return ptr;
+    }
+    return safeSpanRecheck(span, ptr, size);
+}
+
+/* safeSpanStrided : Same as safeSpanAt for the size bytes of element index in an array of elements stride bytes apart. */
+static inline void *safeSpanStrided(safeSpan *span, void *base, size_t index, size_t stride, size_t size)
+{
+    return safeSpanAt(span, (char*)base + index * stride, size);
+}
+
+/* memcheckSafeRefill : Slow path of memcheckSafeFast. Memory that was never allocated with mallocSafe (stack, globals, plain malloc)
+                        is let through, as is a freed block that has gone back to malloc (plain malloc may be reusing it).
+                        A freed block still held in the quarantine, or an access running off a block, is reported like
+                        memcheckSafe does. */
+void memcheckSafeRefill(void *ptr, size_t size);
+
+/* memcheckSafeFast   : Check used by compiler-inserted instrumentation (see SafeCheckPass.cpp). Accesses inside the last block it
+                        found cost a few compares; anything else goes to memcheckSafeRefill, which caches the new block. */
+static inline void memcheckSafeFast(void *ptr, size_t size)
+{
+    if(!safeSpanCovers(&safeCheckCache, ptr, size))
+    {
+        memcheckSafeRefill(ptr, size);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // MALLOC_H_
\ No newline at end of file
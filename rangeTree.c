@@ -1,18 +1,66 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "rangeTree.h"
+#include "safeProbes.h"
 
-node * createNode(void * ptr, size_t size)
+#define TREE_SLAB_SIZE (64 * 1024)
+
+//nodes and ranges come from their own mmap'd slabs rather than from malloc, so they never end up in between the blocks
+//malloc hands to mallocSafe - the slots are recycled through a free list and the slabs are never given back
+typedef union treeSlot
 {
-    //allocate space for this node
-    node * nodeStruct = malloc(sizeof(node));
-    if(!nodeStruct)
+    node nodeSlot;
+    range rangeSlot;
+    union treeSlot * next;
+    
+} treeSlot;
+
+static treeSlot * freeSlots = NULL;
+
+static void * allocSlot(void)
+{
+    if(!freeSlots)
     {
-        fprintf(stderr, "Error: Memory allocation failed. Exiting.");
-        exit(EXIT_FAILURE);
+        treeSlot * slab = mmap(NULL, TREE_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(slab == MAP_FAILED)
+        {
+            fprintf(stderr, "Error: Memory allocation failed. Exiting.");
+            exit(EXIT_FAILURE);
+        }
+        
+        for(size_t i = 0; i < TREE_SLAB_SIZE / sizeof(treeSlot); i++)
+        {
+            slab[i].next = freeSlots;
+            freeSlots = &slab[i];
+        }
     }
     
+    treeSlot * slot = freeSlots;
+    freeSlots = slot->next;
+    return slot;
+}
+
+static void releaseSlot(void * ptr)
+{
+    treeSlot * slot = ptr;
+    slot->next = freeSlots;
+    freeSlots = slot;
+}
+
+//gives a node and its range back to the slabs
+void freeNode(node * nodeStruct)
+{
+    releaseSlot(nodeStruct->addrRange);
+    releaseSlot(nodeStruct);
+}
+
+node * createNode(void * ptr, size_t size, unsigned int tag)
+{
+    //allocate space for this node
+    node * nodeStruct = allocSlot();
+    
     
     //structure variables for this interval graph node
     nodeStruct->addrRange = createRange(ptr, size); //pointer to the address range that this block covers
@@ -20,6 +68,8 @@ node * createNode(void * ptr, size_t size)
     nodeStruct->left = nodeStruct->right = NULL;    //empty child nodes
     nodeStruct->freed = 0;                          //this memory block (trivially) hasn't been freed yet
     nodeStruct->height = 1;
+    nodeStruct->tag = tag;                          //allocation tag used for per-tag byte accounting
+    nodeStruct->mapped = 0;                         //set by mallocSafe for blocks it maps itself
     
     return nodeStruct;
 }
@@ -28,12 +78,7 @@ node * createNode(void * ptr, size_t size)
 
 range * createRange(void * ptr, size_t size)
 {
-    range * rangeStruct = malloc(sizeof(range));
-    if(!rangeStruct)
-    {
-        fprintf(stderr, "Error: Memory allocation failed. Exiting.");
-        exit(EXIT_FAILURE);
-    }
+    range * rangeStruct = allocSlot();
     
     //structure variables for this interval
     rangeStruct->start = ptr;
@@ -71,6 +116,8 @@ node * insertNodeList(node ** head, node * newNode)
 // function that rotates the tree to the right if unbalanced
 node * rotateTreeRight(node * nodeStruct)
 {
+    SAFE_PROBE1(rotate_right, nodeStruct->addrRange->start);
+    
     node * leftSub = nodeStruct->left; //take left subtree of parameter node
     node * leftRightSub = leftSub->right; //take right subtree of the left parameter subtree
 
@@ -90,6 +137,8 @@ node * rotateTreeRight(node * nodeStruct)
 // function that rotates the tree to the left if unbalanced
 node * rotateTreeLeft(node * nodeStruct)
 {
+    SAFE_PROBE1(rotate_left, nodeStruct->addrRange->start);
+    
     node * rightSub = nodeStruct->right; //take right subtree of parameter node
     node * rightLeftSub = rightSub->left; //take left subtree of the right paramter subtree
     
@@ -116,23 +165,31 @@ int checkBalance(node * current)
     return getHeight(current->left) - getHeight(current->right);
 }
 
-node * insertNode(node * root, void* ptr, size_t size)
+node * insertNode(node * root, void* ptr, size_t size, unsigned int tag)
 {
+    return insertNodeStruct(root, createNode(ptr, size, tag));
+}
+
+//inserts an already created node - for callers that need to set its flags (freed, mapped) before it goes in
+node * insertNodeStruct(node * root, node * newNode)
+{
+    void * ptr = newNode->addrRange->start;
+    
     //BASE CASE | get to end of tree
     if(!root)
     {
-        return createNode(ptr, size);
+        return newNode;
     }
     
     //RECURSIVE CASE | insert node at left or right of root
     //if the our new start addr is lower than the root's start addr, our new node should go to the left subtree
     if(ptr < root->addrRange->start) //if addr is earlier in memory
     {
-        root->left = insertNode(root->left, ptr, size); //insert new node at the root's left
+        root->left = insertNodeStruct(root->left, newNode); //insert new node at the root's left
     }
     else //if addr is >= in memory
     {
-        root->right = insertNode(root->right, ptr, size); //insert new node at the root's right
+        root->right = insertNodeStruct(root->right, newNode); //insert new node at the root's right
     }    
     
     // Update height
@@ -224,20 +281,21 @@ node * removeNode(node * root, void * ptr)
             // no child
             if(tempNode == NULL)
             {
-                //tempNode = root;
+                freeNode(root);
                 root = NULL;
                 //new max remains NULL
             }
             // one child
             else
             {
+                range * oldRange = root->addrRange;
                 *root = *tempNode;
                 //new max is the max of the left or right subtree of this node (whichever it has)
+                
+                //the child's contents live on in root now
+                releaseSlot(oldRange);
+                releaseSlot(tempNode);
             }
-            
-            //free(tempNode->addrRange);
-            //free(tempNode);
-            //tempNode = NULL;
         }
         else
         {
@@ -247,8 +305,13 @@ node * removeNode(node * root, void * ptr)
             //save off the original max
             newMax = root->right->max; //should be the same max as before!
             
-            // min right subtree node becomes new root
+            // min right subtree node becomes new root (the whole block description moves, not just the start,
+            // so the size and tag used for accounting stay attached to the right address)
             root->addrRange->start = tempNode->addrRange->start;
+            root->addrRange->end = tempNode->addrRange->end;
+            root->freed = tempNode->freed;
+            root->tag = tempNode->tag;
+            root->mapped = tempNode->mapped;
             root->right = removeNode(root->right, tempNode->addrRange->start);
         }
     }
@@ -259,11 +322,8 @@ node * removeNode(node * root, void * ptr)
         return root;
     }
     
-    // update height of node
-    if(root->left || root->right )
-    {
-        root->height = 1 + maxHeight(getHeight(root->left), getHeight(root->right));
-    }
+    // update height of node (a node that just lost its last child is back to height 1)
+    root->height = 1 + maxHeight(getHeight(root->left), getHeight(root->right));
     
     
     //update the max of any ancestor to reflect that a node was removed
@@ -340,6 +400,16 @@ int getHeight(node * current)
     return current->height;
 }
 
+//number of nodes (live and freed blocks) in the tree
+int countNodes(node * root)
+{
+    if(root == NULL)
+    {
+        return 0;
+    }
+    return 1 + countNodes(root->left) + countNodes(root->right);
+}
+
 // function that compares the height of left and right subtree
 int maxHeight(int height1, int height2)
 {
@@ -360,10 +430,15 @@ int maxHeight(int height1, int height2)
 //    - freeing a pointer 
 node * checkTreeContainsPtr(node * root, void * searchKey, int freeFlag)
 {
+    int depth = 0; //nodes visited, for the lookup_depth probe
     while(root)
     {
-        //check if this is the right node
-        if(root->addrRange->start == searchKey)
+        depth++;
+        
+        //check if this is the right node - a freed node can hold several coalesced blocks, so any address inside it
+        //counts as one of its (already freed) blocks
+        if(root->addrRange->start == searchKey || 
+           (root->freed == 1 && searchKey > root->addrRange->start && searchKey < root->addrRange->start + root->addrRange->end))
         {
             //check if trying to free already free block
             if(root->freed == 1)
@@ -388,6 +463,7 @@ node * checkTreeContainsPtr(node * root, void * searchKey, int freeFlag)
                 }
                 else //this pointer is in the tree BUT it has already been freed - just fine!
                 {
+                    SAFE_PROBE2(lookup_depth, searchKey, depth);
                     return NULL;
                 }
             }
@@ -397,9 +473,10 @@ node * checkTreeContainsPtr(node * root, void * searchKey, int freeFlag)
             //printf("Search function found matching pointer at height %i: %p\n", height, (void*)root->addrRange->start);
             //end test print
             
+            SAFE_PROBE2(lookup_depth, searchKey, depth);
             return root;
         }
-        else if(searchKey >= root->addrRange->start && searchKey <= root->addrRange->start + root->addrRange->end)
+        else if(searchKey >= root->addrRange->start && searchKey < root->addrRange->start + root->addrRange->end) //the end address is the next block's start
         {
             if(freeFlag == 1)
             {
@@ -421,8 +498,10 @@ node * checkTreeContainsPtr(node * root, void * searchKey, int freeFlag)
                 fprintf(stderr, "       Exiting.\n");
                 exit(-1);
             }
-            
-            
+            else //plain lookup - a pointer inside some other block just isn't a match, keep searching (it is higher)
+            {
+                root = root->right;
+            }
         }
         else
         {
@@ -439,6 +518,7 @@ node * checkTreeContainsPtr(node * root, void * searchKey, int freeFlag)
     }
     
     //if you get to the end of the tree and you didn't find it, it isn't here
+    SAFE_PROBE2(lookup_depth, searchKey, depth);
     return NULL;
 }
 
@@ -452,12 +532,16 @@ node * checkTreeContainsPtr(node * root, void * searchKey, int freeFlag)
 int checkTreeContainsInterval(node * root, void * searchKey, size_t size)
 {
     int lowerBoundFound = 0;
+    int depth = 0; //nodes visited, for the lookup_depth probe
     while(root)
     {
+        depth++;
+        
         //check if this node and the searchKey pointer+size overlap
         if(searchKey >= root->addrRange->start && searchKey + size <= root->addrRange->start + root->addrRange->end)
         {
             //the node is contained in this interval!
+            SAFE_PROBE2(lookup_depth, searchKey, depth);
             if(root->freed == 1)
             {
                 return -2;
@@ -489,6 +573,7 @@ int checkTreeContainsInterval(node * root, void * searchKey, size_t size)
     }
     
     //if you got here, the interval doesn't fit in the tree - must return correct error code
+    SAFE_PROBE2(lookup_depth, searchKey, depth);
     if(lowerBoundFound > 0)
     {
         return lowerBoundFound;
@@ -500,9 +585,41 @@ int checkTreeContainsInterval(node * root, void * searchKey, size_t size)
 }
 
 
+//Finds the node whose interval contains the whole query interval (freed or not)
+//Same search as checkTreeContainsInterval, but hands back the node so the caller can keep its bounds
+node * findTreeBlock(node * root, void * searchKey, size_t size)
+{
+    int depth = 0; //nodes visited, for the lookup_depth probe
+    while(root)
+    {
+        depth++;
+        if(searchKey >= root->addrRange->start && searchKey + size <= root->addrRange->start + root->addrRange->end)
+        {
+            SAFE_PROBE2(lookup_depth, searchKey, depth);
+            return root;
+        }
+        
+        //go to the left or right subtree
+        if(searchKey < root->addrRange->start) //lower - left
+        {
+            root = root->left;
+        }
+        else
+        {
+            root = root->right; //higher - right 
+        }
+    }
+    
+    SAFE_PROBE2(lookup_depth, searchKey, depth);
+    return NULL;
+}
+
+
 //When malloc or realloc gets a pointer assigned (and an accompanying size) we have to update the tree with this new node
 //BUT before we can insert the new node (will happen right after this call) we need to remove any node that would overlap with this one
-//So we add all overlapping nodes to a list so they can be deleted!
+//So we add a copy of every overlapping node to a list (linked through right) so the caller can delete them and put back 
+//whatever parts of them stick out of the new block - a coalesced freed node may only be partly covered
+//Blocks in the tree never overlap each other, so only nodes starting inside the block, or the one node right before it, can overlap
 int checkTreeBlockBounds(node * root, void * searchKey, size_t size, node ** nodesToDelete)
 {    
     if(root == NULL) //got to the end!
@@ -510,36 +627,68 @@ int checkTreeBlockBounds(node * root, void * searchKey, size_t size, node ** nod
         return 0;
     }
     
+    void * start = root->addrRange->start;
+    void * end = root->addrRange->start + root->addrRange->end;
     
-    if(root->addrRange->start <= (void*)(searchKey + size) && (void*)(root->addrRange->start + root->addrRange->end) >= searchKey)
+    //lower intervals can only reach into the block if this one starts after the block does
+    if(start > searchKey)
+    {
+        checkTreeBlockBounds(root->left, searchKey, size, nodesToDelete);
+    }
+    
+    if(start == searchKey || (start < searchKey + size && end > searchKey))
     {        
-        //if this node is the START do the start checks
-        if(root->addrRange->start == searchKey) //if this node is at the start of the old freed node
+        node * copy = createNode(start, root->addrRange->end, root->tag);
+        copy->freed = root->freed;
+        copy->mapped = root->mapped;
+        insertNodeList(nodesToDelete, copy); //add this node to the nodesToDeleteList
+        SAFE_PROBE3(evict, start, root->addrRange->end, root->freed);
+    }
+    
+    //higher intervals can only reach into the block if this one starts before the block ends
+    if(start < searchKey + size)
+    {
+        checkTreeBlockBounds(root->right, searchKey, size, nodesToDelete);
+    }
+    return 0;
+}
+
+
+//finds the node with the highest start address below searchKey
+node * predecessorNode(node * root, void * searchKey)
+{
+    node * best = NULL;
+    while(root)
+    {
+        if(root->addrRange->start < searchKey)
         {
-            //this node should just be deleted
+            best = root;
+            root = root->right;
         }
-        
-        //if this interval starts somewhere in the middle of the old freed node
-        else if(root->addrRange->start < searchKey && (void*)(root->addrRange->start + root->addrRange->end) >= searchKey)
+        else
         {
-            //update old node to being a free block going from the original start to the start of our new block
-            root->addrRange->end = (searchKey - root->addrRange->start);
+            root = root->left;
         }
-        
-        //otherwise, add the whole node to the delete list 
-        *nodesToDelete = insertNodeList(nodesToDelete, root); //add this node to the nodesToDeleteList
-
-    }
-    
-    //pick the lower or higher intervals for the next recursive iteration 
-    if(searchKey < root->addrRange->start) //lower
-    {
-        checkTreeBlockBounds(root->left, searchKey, size, nodesToDelete);
-        
     }
-    else //higher
+    return best;
+}
+
+
+//finds the node with the lowest start address above searchKey
+node * successorNode(node * root, void * searchKey)
+{
+    node * best = NULL;
+    while(root)
     {
-        checkTreeBlockBounds(root->right, searchKey, size, nodesToDelete);
+        if(root->addrRange->start > searchKey)
+        {
+            best = root;
+            root = root->left;
+        }
+        else
+        {
+            root = root->right;
+        }
     }
-    return 0;
+    return best;
 }
@@ -16,13 +16,17 @@ typedef struct node
     struct node * right;   //right node (higher address interval)
     int freed;             //indicates if this memory block has been freed already and shouldn't be re-freed
     int height;
+    unsigned int tag;      //allocation tag this block is accounted under (0 for untagged calls)
+    int mapped;            //block was served by mmap and has a guard page after it
    
 } node; 
 
 
-node * createNode(void * ptr, size_t size);
+node * createNode(void * ptr, size_t size, unsigned int tag);
 range * createRange(void * ptr, size_t size);
-node * insertNode(node * root, void* ptr, size_t size);
+void freeNode(node * nodeStruct);
+node * insertNode(node * root, void* ptr, size_t size, unsigned int tag);
+node * insertNodeStruct(node * root, node * newNode);
 node * insertNodeList(node ** head, node * newNode);
 node * removeNode(node * root, void* ptr);
 node * minNode(node * rightNode);
@@ -30,8 +34,12 @@ int checkBalance(node * current);
 int maxHeight(int height1, int height2);
 int getHeight(node * current);
 void preOrder(node * root);
+int countNodes(node * root);
 node * checkTreeContainsPtr(node * root, void * searchKey, int freeFlag);  //for free and malloc
 int checkTreeContainsInterval(node * root, void * searchKey, size_t size); //most useful for memcheck
+node * findTreeBlock(node * root, void * searchKey, size_t size);          //for checked spans
 int checkTreeBlockBounds(node * root, void * searchKey, size_t size, node ** nodesToDelete);      //for malloc and realloc
+node * predecessorNode(node * root, void * searchKey);   //for coalescing freed blocks
+node * successorNode(node * root, void * searchKey);     //for coalescing freed blocks
 
 #endif // LINKEDLIST_H_
\ No newline at end of file
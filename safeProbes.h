@@ -0,0 +1,33 @@
+#ifndef SAFEPROBES_H_
+#define SAFEPROBES_H_
+
+/* USDT (sys/sdt.h) probes under the "safemalloc" provider, for tracing with perf or bpftrace (see bpftrace/).
+   Each probe is a single nop in the code until a tracer attaches to it. Without sys/sdt.h, or with -DSAFE_NO_PROBES,
+   the probes compile away entirely.
+
+   malloc_entry(size, tag)          malloc_return(ptr, size)
+   free_entry(ptr)                  free_return(ptr, size)
+   realloc_entry(ptr, size)         realloc_return(oldPtr, newPtr, size)
+   memcheck_entry(ptr, size)        memcheck_return(ptr, size, result)   result is checkTreeContainsInterval's code
+   rotate_left(start)               rotate_right(start)                  start of the node rotated down
+   evict(start, size, freed)        node overlapping a new block, removed (and split) by mallocSafe/reallocSafe
+   lookup_depth(ptr, depth)         nodes visited by a tree search for ptr */
+
+#if !defined(SAFE_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SAFE_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef SAFE_PROBES_ENABLED
+#define SAFE_PROBE1(name, a)        DTRACE_PROBE1(safemalloc, name, a)
+#define SAFE_PROBE2(name, a, b)     DTRACE_PROBE2(safemalloc, name, a, b)
+#define SAFE_PROBE3(name, a, b, c)  DTRACE_PROBE3(safemalloc, name, a, b, c)
+#else
+#define SAFE_PROBE1(name, a)        ((void)(a))
+#define SAFE_PROBE2(name, a, b)     ((void)(a), (void)(b))
+#define SAFE_PROBE3(name, a, b, c)  ((void)(a), (void)(b), (void)(c))
+#endif
+
+#endif // SAFEPROBES_H_
@@ -0,0 +1,100 @@
+#include <numeric>
+#include <vector>
+#include "SafeAllocator.hpp"
+#include "testUtil.h"
+
+//SafeAllocator.hpp: containers over each policy, span bounds, Sampling's mixed blocks and the pmr resource
+
+//fills a vector through the policy's allocator and checks the contents survive the reallocations
+template <class Policy>
+static void vectorUnder(const char * name, bool tracked)
+{
+    std::vector<int, safe::Allocator<int, Policy>> values;
+    for(int i = 0; i < 1000; i++)
+    {
+        values.push_back(i);
+    }
+    
+    if(std::accumulate(values.begin(), values.end(), 0L) != 999L * 1000 / 2)
+    {
+        printf("FAIL: vector under %s lost its contents\n", name);
+        failures++;
+    }
+    if((isAllocatedSafe(values.data()) != 0) != tracked)
+    {
+        printf("FAIL: vector under %s was%s tracked\n", name, tracked ? "n't" : "");
+        failures++;
+    }
+}
+
+static void indexPastSpan()
+{
+    std::vector<int, safe::Allocator<int, safe::Tracking>> values(10);
+    values.reserve(100);
+    safe::Span<int, safe::Tracking> span(values);
+    span[span.size()] = 1; //inside the block, but past the span
+}
+
+static void stridePastSpan()
+{
+    std::vector<int> values(10);
+    safe::Span<int, safe::Tracking> span(values);
+    span.strided(4, 3);
+}
+
+int main()
+{
+    vectorUnder<safe::Tracking>("Tracking", true);
+    vectorUnder<safe::NoTracking>("NoTracking", false);
+    vectorUnder<safe::Sampling<1>>("Sampling<1>", true);
+    
+    //spans check accesses against their length, over tracked blocks and anything else alike
+    std::vector<int, safe::Allocator<int, safe::Tracking>> tracked(100, 1);
+    safe::Span<int, safe::Tracking> whole(tracked);
+    safe::Span<int, safe::Tracking> middle(tracked.data() + 10, 20);
+    std::vector<int> plain(10, 2);
+    safe::Span<int, safe::Tracking> untracked(plain);
+    expect(whole[99] + middle[19] + untracked[9] == 4 && whole.strided(9, 11) == 1, "span access returned the wrong element");
+    expectError(indexPastSpan, "span index past its length");
+    expectError(stridePastSpan, "strided span index past its length");
+    
+    //Sampling<2> tracks every other block, and has to free each kind the right way
+    safe::Allocator<char, safe::Sampling<2>> sampling;
+    char * blocks[8];
+    int trackedCount = 0;
+    for(char *& block : blocks)
+    {
+        block = sampling.allocate(64);
+        trackedCount += isAllocatedSafe(block);
+    }
+    expect(trackedCount == 4, "Sampling<2> didn't track every other block");
+    for(char * block : blocks)
+    {
+        sampling.deallocate(block, 64);
+    }
+    for(char * block : blocks)
+    {
+        expect(!isAllocatedSafe(block), "Sampling left a tracked block live after deallocate");
+    }
+    
+    //reallocate grows a tracked block in place of a copy
+    safe::Allocator<int, safe::Tracking> ints;
+    int * grown = ints.allocate(4);
+    grown[3] = 42;
+    grown = ints.reallocate(grown, 4000);
+    expect(grown[3] == 42 && isTrackedSafe(grown, 4000 * sizeof(int)), "reallocate lost the contents or the block");
+    ints.deallocate(grown, 4000);
+    
+#ifdef SAFE_ALLOCATOR_HAS_PMR
+    safe::MemoryResource<safe::Tracking> resource;
+    std::pmr::vector<int> pmrValues(&resource);
+    for(int i = 0; i < 100; i++)
+    {
+        pmrValues.push_back(i);
+    }
+    expect(std::accumulate(pmrValues.begin(), pmrValues.end(), 0) == 99 * 100 / 2, "pmr vector lost its contents");
+    expect(isAllocatedSafe(pmrValues.data()), "pmr vector isn't backed by a tracked block");
+#endif
+    
+    return finishTest("allocatorTest");
+}
@@ -0,0 +1,79 @@
+#include "Safemalloc.h"
+#include "testUtil.h"
+
+//freed neighbours are merged into one node even though malloc leaves a chunk header between them
+
+#define RUN 1000
+
+static char * blocks[RUN];
+
+//the tree may only grow by a handful of nodes over what it held before a run of blocks was allocated and freed
+static void expectCollapsed(int before, const char * name)
+{
+    int after = getTreeSizeSafe();
+    if(after > before + 2)
+    {
+        printf("FAIL: %s left %i nodes behind (%i before)\n", name, after - before, before);
+        failures++;
+    }
+}
+
+static void useInsideMergedRange(void)
+{
+    memcheckSafe(blocks[RUN / 2], 8);
+}
+
+static void doubleFreeInsideMergedRange(void)
+{
+    freeSafe(blocks[RUN / 2]);
+}
+
+int main(void)
+{
+    int before = getTreeSizeSafe();
+    
+    //freed in allocation order
+    for(int i = 0; i < RUN; i++)
+    {
+        blocks[i] = mallocSafe(24);
+    }
+    for(int i = 0; i < RUN; i++)
+    {
+        freeSafe(blocks[i]);
+    }
+    expectCollapsed(before, "freeing a run of blocks in order");
+    
+    //a freed block inside a merged range is still reported
+    expectError(useInsideMergedRange, "use after free inside a merged range");
+    expectError(doubleFreeInsideMergedRange, "double free inside a merged range");
+    
+    //freed in reverse, with mixed sizes
+    before = getTreeSizeSafe();
+    for(int i = 0; i < RUN; i++)
+    {
+        blocks[i] = mallocSafe(1 + (i * 37) % 300);
+    }
+    for(int i = RUN - 1; i >= 0; i--)
+    {
+        freeSafe(blocks[i]);
+    }
+    expectCollapsed(before, "freeing a run of mixed size blocks in reverse");
+    
+    //every other block first, then the rest fill the holes
+    before = getTreeSizeSafe();
+    for(int i = 0; i < RUN; i++)
+    {
+        blocks[i] = mallocSafe(40);
+    }
+    for(int i = 0; i < RUN; i += 2)
+    {
+        freeSafe(blocks[i]);
+    }
+    for(int i = 1; i < RUN; i += 2)
+    {
+        freeSafe(blocks[i]);
+    }
+    expectCollapsed(before, "freeing alternate blocks, then the rest");
+    
+    return finishTest("coalesceTest");
+}
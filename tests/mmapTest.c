@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <string.h>
+#include "Safemalloc.h"
+#include "testUtil.h"
+
+//large blocks: guard page, mremap resizing, heap blocks moving to a mapping, and the PROT_NONE quarantine
+
+#define THRESHOLD (64 * 1024)
+
+static size_t page;
+
+//1 if every byte of the size bytes at ptr is value
+static int filledWith(const char * ptr, size_t size, char value)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        if(ptr[i] != value)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void writePastMappedBlock(void)
+{
+    size_t size = 16 * page;
+    char * block = mallocSafe(size);
+    block[size] = 1; //first byte of the guard page
+}
+
+static void writePastMovedBlock(void)
+{
+    char * block = mallocSafe(1000);
+    block = reallocSafe(block, 32 * page);
+    block[32 * page] = 1;
+}
+
+static void useQuarantinedBlock(void)
+{
+    setMmapQuarantineSafe(4);
+    char * block = mallocSafe(THRESHOLD);
+    freeSafe(block);
+    block[0] = 1;
+}
+
+int main(void)
+{
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    setMmapThresholdSafe(THRESHOLD);
+    
+    //mapped blocks start a mapping, and running off the end of a page-multiple block hits the guard page
+    char * block = mallocSafe(THRESHOLD);
+    expect((uintptr_t)block % page == 0, "mapped block doesn't start on a page");
+    freeSafe(block);
+    expectFault(writePastMappedBlock, "write one byte past a mapped block");
+    
+    //growing inside the block's last page and shrinking both stay in place, keep the contents and move the node's end
+    size_t size = THRESHOLD + 100;
+    block = mallocSafe(size);
+    memset(block, 7, size);
+    char * grown = reallocSafe(block, size + 100);
+    expect(grown == block, "growing inside the last page moved the block");
+    expect(filledWith(grown, size, 7), "growing in place lost the contents");
+    expect(isTrackedSafe(grown, size + 100), "growing in place didn't extend the node");
+    
+    char * shrunk = reallocSafe(grown, THRESHOLD / 2 + page);
+    expect(shrunk == grown, "shrinking moved the block");
+    expect(filledWith(shrunk, THRESHOLD / 2 + page, 7), "shrinking lost the contents");
+    expect(isTrackedSafe(shrunk, THRESHOLD / 2 + page), "shrinking lost the node");
+    expect(!isTrackedSafe(shrunk, THRESHOLD / 2 + page + 1), "shrinking didn't cut the node's end");
+    
+    //growing over whole pages keeps the contents wherever mremap puts the block
+    char * remapped = reallocSafe(shrunk, 8 * THRESHOLD);
+    expect(filledWith(remapped, THRESHOLD / 2 + page, 7), "growing a mapped block lost the contents");
+    expect(isTrackedSafe(remapped, 8 * THRESHOLD), "growing a mapped block didn't extend the node");
+    freeSafe(remapped);
+    
+    //a heap block growing past the threshold moves to a mapping of its own
+    block = mallocSafe(1000);
+    memset(block, 3, 1000);
+    char * moved = reallocSafe(block, 32 * page);
+    expect((uintptr_t)moved % page == 0, "heap block growing past the threshold wasn't mapped");
+    expect(filledWith(moved, 1000, 3), "moving a heap block to a mapping lost the contents");
+    expect(isTrackedSafe(moved, 32 * page) && !isAllocatedSafe(block), "moving a heap block to a mapping left the tree behind");
+    freeSafe(moved);
+    expectFault(writePastMovedBlock, "write past a heap block moved to a mapping");
+    
+    //a heap block above a lowered threshold moves to a mapping even when it shrinks
+    setMmapThresholdSafe(0);
+    block = mallocSafe(16 * THRESHOLD);
+    memset(block, 5, 16 * THRESHOLD);
+    setMmapThresholdSafe(THRESHOLD);
+    moved = reallocSafe(block, 2 * THRESHOLD);
+    expect((uintptr_t)moved % page == 0, "shrinking heap block above the threshold wasn't mapped");
+    expect(filledWith(moved, 2 * THRESHOLD, 5), "shrinking a heap block into a mapping lost the contents");
+    freeSafe(moved);
+    
+    //a freed block in the quarantine stays mapped PROT_NONE
+    expectFault(useQuarantinedBlock, "use after free of a quarantined mapped block");
+    
+    return finishTest("mmapTest");
+}
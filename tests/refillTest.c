@@ -0,0 +1,78 @@
+#include "Safemalloc.h"
+#include "testUtil.h"
+
+//memcheckSafeRefill: freed blocks are only reported while they are still quarantined, since plain malloc may reuse them
+
+static void useAfterFree(void)
+{
+    char * block = mallocSafe(40);
+    freeSafe(block);
+    memcheckSafeFast(block, 4);
+}
+
+static void useAfterReallocToZero(void)
+{
+    char * block = mallocSafe(40);
+    reallocSafe(block, 0);
+    memcheckSafeFast(block, 4);
+}
+
+static void overflow(void)
+{
+    char * block = mallocSafe(40);
+    memcheckSafeFast(block + 36, 8);
+}
+
+int main(void)
+{
+    //a freed block that went back to malloc and came out of plain malloc is not a use after free
+    char * block = mallocSafe(40);
+    freeSafe(block);
+    for(int i = 0; i < SAFE_FREE_QUARANTINE; i++)
+    {
+        freeSafe(mallocSafe(200)); //push block out of the quarantine without mallocSafe taking it back
+    }
+    
+    int reused = 0;
+    for(int i = 0; i < 64 && !reused; i++)
+    {
+        char * plain = malloc(40);
+        memcheckSafeFast(plain, 40);
+        reused = plain == block;
+    }
+    expect(reused, "malloc never handed the freed block out again");
+    
+    //same, for a reused block that is bigger than the freed one and accessed past the freed node's end
+    char * small = mallocSafe(25);
+    char * live = mallocSafe(8);
+    freeSafe(small);
+    for(int i = 0; i < SAFE_FREE_QUARANTINE; i++)
+    {
+        freeSafe(mallocSafe(200));
+    }
+    
+    reused = 0;
+    for(int i = 0; i < 64 && !reused; i++)
+    {
+        char * plain = malloc(40);
+        memcheckSafeFast(plain + 16, 16);
+        reused = plain == small;
+    }
+    expect(reused, "malloc never handed the smaller freed block out again");
+    freeSafe(live);
+    
+    //blocks too big for the quarantine's byte limit go straight back to malloc, so they aren't judged either
+    char * big = mallocSafe(SAFE_FREE_QUARANTINE_BYTES + 1);
+    freeSafe(big);
+    memcheckSafeFast(big, 4);
+    
+    //memory the tree never saw is let through
+    char local[16];
+    memcheckSafeFast(local, sizeof(local));
+    
+    expectError(useAfterFree, "use after free of a quarantined block");
+    expectError(useAfterReallocToZero, "use after reallocSafe(ptr, 0) of a quarantined block");
+    expectError(overflow, "access running off a block");
+    
+    return finishTest("refillTest");
+}
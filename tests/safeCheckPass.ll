@@ -0,0 +1,101 @@
+; Input for make test-plugin: run through opt -passes=safecheck, checked with FileCheck against the CHECK lines below,
+; then compiled with llc and linked into tests/safeCheckPassTest.c, which checks the instrumented code at run time.
+; Typed-pointer IR, as read by LLVM 14.
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+; CHECK: @safeCheckCache = external global %struct.safeSpan
+; CHECK: @safeSpanGenerations = external global [1024 x i64]
+
+; a contiguous walk is checked once in the preheader, for n * 4 bytes, and not at all in the loop
+; CHECK-LABEL: define i64 @sum(
+; CHECK: loop.preheader:
+; CHECK: [[BYTES:%[0-9]+]] = shl i64 %n, 2
+; CHECK: call void @memcheckSafeRefill(i8* {{%[0-9]+}}, i64 [[BYTES]])
+; CHECK: loop:
+; CHECK-NOT: memcheckSafeRefill
+; CHECK: ret i64
+define i64 @sum(i32* %p, i64 %n) {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %loop, label %exit
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %addr = getelementptr inbounds i32, i32* %p, i64 %i
+  %v = load i32, i32* %addr
+  %ve = sext i32 %v to i64
+  %acc.next = add i64 %acc, %ve
+  %i.next = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %r = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  ret i64 %r
+}
+
+; a walk downwards is checked from its lowest address
+; CHECK-LABEL: define void @fill_down(
+; CHECK: loop.preheader:
+; CHECK: call void @memcheckSafeRefill(i8* %p, i64 %n)
+; CHECK: loop:
+; CHECK-NOT: memcheckSafeRefill
+; CHECK: ret void
+define void @fill_down(i8* %p, i64 %n) {
+entry:
+  %cmp = icmp sgt i64 %n, 0
+  br i1 %cmp, label %loop, label %exit
+loop:
+  %i = phi i64 [ %n, %entry ], [ %i.next, %loop ]
+  %i.next = add nsw i64 %i, -1
+  %addr = getelementptr inbounds i8, i8* %p, i64 %i.next
+  store i8 7, i8* %addr
+  %c = icmp sgt i64 %i.next, 0
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+; three stores at constant offsets share one 12 byte check, made before the first of them
+; CHECK-LABEL: define void @fields(
+; CHECK: call void @memcheckSafeRefill(i8* {{%[0-9]+}}, i64 12)
+; CHECK-NOT: memcheckSafeRefill
+; CHECK: store i32 1, i32* %p
+; CHECK-NOT: memcheckSafeRefill
+; CHECK: ret void
+define void @fields(i32* %p) {
+  %a = getelementptr inbounds i32, i32* %p, i64 1
+  %b = getelementptr inbounds i32, i32* %p, i64 2
+  store i32 1, i32* %p
+  store i32 2, i32* %a
+  store i32 3, i32* %b
+  ret void
+}
+
+; a call between two accesses may free the block, so each side gets its own check
+; CHECK-LABEL: define void @around_call(
+; CHECK: call void @memcheckSafeRefill(i8* {{%[0-9]+}}, i64 4)
+; CHECK: store i32 1, i32* %p
+; CHECK: call void @opaque()
+; CHECK: call void @memcheckSafeRefill(i8* {{%[0-9]+}}, i64 4)
+; CHECK: store i32 2, i32* %p
+declare void @opaque()
+
+define void @around_call(i32* %p) {
+  store i32 1, i32* %p
+  call void @opaque()
+  store i32 2, i32* %p
+  ret void
+}
+
+; stack objects are never checked
+; CHECK-LABEL: define i32 @local(
+; CHECK-NOT: memcheckSafeRefill
+; CHECK: ret i32
+define i32 @local() {
+  %x = alloca i32
+  store i32 5, i32* %x
+  %v = load i32, i32* %x
+  ret i32 %v
+}
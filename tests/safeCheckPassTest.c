@@ -0,0 +1,65 @@
+#include "Safemalloc.h"
+#include "testUtil.h"
+
+//run time half of make test-plugin: the functions come from tests/safeCheckPass.ll after opt -passes=safecheck and llc
+
+long sum(int * p, long n);
+void fill_down(char * p, long n);
+void fields(int * p);
+int local(void);
+void around_call(int * p);
+
+//called by around_call between its two stores
+static int * freedByOpaque = NULL;
+void opaque(void)
+{
+    if(freedByOpaque)
+    {
+        freeSafe(freedByOpaque);
+    }
+}
+
+static void sumPastEnd(void)
+{
+    int * block = mallocSafe(100 * sizeof(int));
+    sum(block, 101);
+}
+
+static void fieldsPastEnd(void)
+{
+    int * block = mallocSafe(2 * sizeof(int));
+    fields(block);
+}
+
+static void fieldsAfterFree(void)
+{
+    int * block = mallocSafe(3 * sizeof(int));
+    freeSafe(block);
+    fields(block);
+}
+
+static void storeAfterCallFrees(void)
+{
+    freedByOpaque = mallocSafe(sizeof(int));
+    around_call(freedByOpaque);
+}
+
+int main(void)
+{
+    //accesses inside a block, and to memory that isn't mallocSafe's, go through
+    int * block = mallocSafe(100 * sizeof(int));
+    fill_down((char*)block, 100 * sizeof(int));
+    fields(block);
+    around_call(block);
+    expect(sum(block, 100) == 7 + 97 * 0x07070707L && local() == 5, "instrumented code computed the wrong result");
+    
+    int stack[4] = {1, 2, 3, 4};
+    expect(sum(stack, 4) == 10, "instrumented code computed the wrong result on the stack");
+    
+    expectError(sumPastEnd, "loop running off a block (hoisted check)");
+    expectError(fieldsPastEnd, "constant-offset stores running off a block (coalesced check)");
+    expectError(fieldsAfterFree, "stores to a freed block");
+    expectError(storeAfterCallFrees, "store after a call freed the block");
+    
+    return finishTest("safeCheckPassTest");
+}
@@ -0,0 +1,65 @@
+#include "Safemalloc.h"
+#include "testUtil.h"
+
+//checked spans: cached bounds, and the generation bump that sends spans on a freed or reallocated block back to the tree
+
+static void accessAfterFree(void)
+{
+    char * block = mallocSafe(64);
+    safeSpan span = safeSpanAcquire(block, 64);
+    freeSafe(block);
+    safeSpanAt(&span, block, 1);
+}
+
+static void accessPastBlock(void)
+{
+    char * block = mallocSafe(64);
+    safeSpan span = safeSpanAcquire(block, 64);
+    safeSpanAt(&span, block + 60, 8);
+}
+
+static void stridePastBlock(void)
+{
+    int * block = mallocSafe(10 * sizeof(int));
+    safeSpan span = safeSpanAcquire(block, 10 * sizeof(int));
+    safeSpanStrided(&span, block, 4, 3 * sizeof(int), sizeof(int));
+}
+
+static void acquireUnallocated(void)
+{
+    char local[8];
+    safeSpanAcquire(local, sizeof(local));
+}
+
+int main(void)
+{
+    //a span vouches for its whole block, wherever in the block it was acquired
+    char * block = mallocSafe(64);
+    safeSpan span = safeSpanAcquire(block + 8, 16);
+    expect(safeSpanCovers(&span, block, 64), "span doesn't cover its block");
+    expect(!safeSpanCovers(&span, block + 60, 8), "span covers bytes past its block");
+    expect(safeSpanAt(&span, block + 63, 1) == block + 63, "safeSpanAt returned the wrong address");
+    
+    //reallocSafe bumps the block's generation, even when the block stays put - the next access rechecks and follows it
+    char * grown = reallocSafe(block, 32);
+    expect(!safeSpanCovers(&span, grown, 1), "span still vouches for a reallocated block");
+    expect(safeSpanAt(&span, grown, 32) == grown && safeSpanCovers(&span, grown, 32), "span didn't move to the reallocated block");
+    expect(!safeSpanCovers(&span, grown, 33), "span kept the block's old size");
+    
+    //an access in another block moves the span there
+    char * other = mallocSafe(16);
+    safeSpanAt(&span, other, 16);
+    expect(safeSpanCovers(&span, other, 16), "span didn't move to the other block");
+    
+    //freeSafe bumps the generation too
+    freeSafe(other);
+    expect(!safeSpanCovers(&span, other, 1), "span still vouches for a freed block");
+    freeSafe(grown);
+    
+    expectError(accessAfterFree, "span access after freeSafe");
+    expectError(accessPastBlock, "span access running off its block");
+    expectError(stridePastBlock, "strided span access past its block");
+    expectError(acquireUnallocated, "acquiring a span on memory mallocSafe didn't allocate");
+    
+    return finishTest("spanTest");
+}
@@ -0,0 +1,89 @@
+#include "Safemalloc.h"
+#include "testUtil.h"
+
+//per-tag accounting, budgets, and reallocSafeTagged moving a block's bytes between tags
+
+//live bytes and blocks currently accounted under tag
+static size_t liveBytes(unsigned int tag)
+{
+    tagStats stats[SAFE_MAX_TAGS];
+    getTagStatsSafe(stats, SAFE_MAX_TAGS);
+    return stats[tag].liveBytes;
+}
+
+static size_t liveCount(unsigned int tag)
+{
+    tagStats stats[SAFE_MAX_TAGS];
+    getTagStatsSafe(stats, SAFE_MAX_TAGS);
+    return stats[tag].liveCount;
+}
+
+static void overHardBudget(void)
+{
+    setTagBudgetSafe(10, 0, 100);
+    mallocSafeTagged(101, 10);
+}
+
+static void reallocOverHardBudget(void)
+{
+    setTagBudgetSafe(10, 0, 100);
+    char * block = mallocSafeTagged(60, 10);
+    reallocSafe(block, 120);
+}
+
+static void moveOverHardBudget(void)
+{
+    setTagBudgetSafe(10, 0, 100);
+    mallocSafeTagged(60, 10);
+    char * block = mallocSafeTagged(60, 11);
+    reallocSafeTagged(block, 60, 10);
+}
+
+static void overSoftBudget(void)
+{
+    setTagBudgetSafe(12, 100, 0);
+    mallocSafeTagged(60, 12);
+    mallocSafeTagged(60, 12); //only warns
+}
+
+static void invalidTag(void)
+{
+    mallocSafeTagged(1, SAFE_MAX_TAGS);
+}
+
+int main(void)
+{
+    tagStats stats[SAFE_MAX_TAGS];
+    expect(getTagStatsSafe(stats, 4) == 4 && getTagStatsSafe(stats, SAFE_MAX_TAGS + 10) == SAFE_MAX_TAGS,
+           "getTagStatsSafe copied the wrong number of tags");
+    
+    //blocks are accounted under their tag until freed, untagged ones under tag 0
+    char * first = mallocSafeTagged(100, 5);
+    char * second = mallocSafeTagged(50, 5);
+    char * untagged = mallocSafe(30);
+    expect(liveBytes(5) == 150 && liveCount(5) == 2, "tagged blocks weren't accounted under their tag");
+    expect(liveBytes(0) == 30 && liveCount(0) == 1, "untagged block wasn't accounted under tag 0");
+    freeSafe(first);
+    freeSafe(untagged);
+    expect(liveBytes(5) == 50 && liveCount(5) == 1, "freeing didn't take the block off its tag");
+    expect(liveBytes(0) == 0 && liveCount(0) == 0, "freeing didn't take the block off tag 0");
+    
+    //reallocSafeTagged moves the block to the new tag, reallocSafe keeps the tag it has
+    second = reallocSafeTagged(second, 80, 7);
+    expect(liveBytes(5) == 0 && liveCount(5) == 0, "reallocSafeTagged left bytes under the old tag");
+    expect(liveBytes(7) == 80 && liveCount(7) == 1, "reallocSafeTagged didn't account the block under the new tag");
+    second = reallocSafe(second, 120);
+    expect(liveBytes(7) == 120 && liveCount(7) == 1, "reallocSafe didn't keep the block's tag");
+    reallocSafe(second, 0);
+    expect(liveBytes(7) == 0 && liveCount(7) == 0, "reallocSafe(ptr, 0) didn't take the block off its tag");
+    
+    //budgets
+    expectError(overHardBudget, "allocation over the hard budget");
+    expectError(reallocOverHardBudget, "reallocSafe growing over the hard budget");
+    expectError(moveOverHardBudget, "reallocSafeTagged moving a block over the new tag's hard budget");
+    expectError(invalidTag, "tag outside of SAFE_MAX_TAGS");
+    int status = runChild(overSoftBudget);
+    expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "going over the soft budget wasn't just a warning");
+    
+    return finishTest("tagTest");
+}
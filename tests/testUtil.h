@@ -0,0 +1,74 @@
+#ifndef TESTUTIL_H_
+#define TESTUTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+//shared by the tests in tests/ - a test counts its failures with the expect helpers and returns finishTest from main,
+//so make test stops at the first test that failed. Cases that should kill the process run in a child process.
+
+static int failures = 0;
+
+//counts a failure if ok is false
+static inline void expect(int ok, const char * what)
+{
+    if(!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+//runs check in a child process with its error output silenced, and returns the child's wait status
+static inline int runChild(void (*check)(void))
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        if(!freopen("/dev/null", "w", stderr))
+        {
+            exit(1);
+        }
+        check();
+        exit(0);
+    }
+    
+    int status;
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+//expects check to be reported - the library prints an error and exits with -1
+static inline void expectError(void (*check)(void), const char * name)
+{
+    int status = runChild(check);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 255)
+    {
+        printf("FAIL: %s was not reported\n", name);
+        failures++;
+    }
+}
+
+//expects check to fault, e.g. on a guard page or a PROT_NONE quarantined block
+static inline void expectFault(void (*check)(void), const char * name)
+{
+    int status = runChild(check);
+    if(!WIFSIGNALED(status) || (WTERMSIG(status) != SIGSEGV && WTERMSIG(status) != SIGBUS))
+    {
+        printf("FAIL: %s did not fault\n", name);
+        failures++;
+    }
+}
+
+//prints the result of the test and returns main's exit status
+static inline int finishTest(const char * name)
+{
+    printf("%s %s\n", name, failures ? "failed" : "passed");
+    return failures != 0;
+}
+
+#endif // TESTUTIL_H_
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "Safemalloc.h"
+
+//workload for the bpftrace scripts in bpftrace/ - a steady malloc/realloc/memcheck/free mix over a pool of live blocks,
+//with a few blocks large enough to be mapped, so every USDT probe fires.
+//usage: ./workload [rounds]
+
+#define WORKLOAD_SLOTS 4096
+
+int main(int argc, char * argv[])
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 1000000;
+    static char * blocks[WORKLOAD_SLOTS];
+    static size_t sizes[WORKLOAD_SLOTS];
+    
+    srand(537);
+    setMmapThresholdSafe(256 * 1024);
+    
+    for(long i = 0; i < rounds; i++)
+    {
+        int slot = rand() % WORKLOAD_SLOTS;
+        int action = rand() % 8;
+        
+        if(!blocks[slot]) //empty slot - allocate, now and then a mapped block
+        {
+            sizes[slot] = (action == 0 && rand() % 64 == 0) ? 256 * 1024 + rand() % (512 * 1024) : 1 + rand() % 512;
+            blocks[slot] = mallocSafe(sizes[slot]);
+        }
+        else if(action < 2) //free
+        {
+            freeSafe(blocks[slot]);
+            blocks[slot] = NULL;
+        }
+        else if(action < 3) //resize
+        {
+            sizes[slot] = sizes[slot] / 2 + 1 + rand() % (sizes[slot] + 1);
+            blocks[slot] = reallocSafe(blocks[slot], sizes[slot]);
+        }
+        else //touch the block, checking first
+        {
+            memcheckSafe(blocks[slot], sizes[slot]);
+            blocks[slot][rand() % sizes[slot]]++;
+        }
+    }
+    
+    for(int slot = 0; slot < WORKLOAD_SLOTS; slot++)
+    {
+        if(blocks[slot])
+        {
+            freeSafe(blocks[slot]);
+        }
+    }
+    
+    printf("workload: %ld rounds, %i tree nodes left\n", rounds, getTreeSizeSafe());
+    return 0;
+}